@@ -0,0 +1,52 @@
+// Copyright (c) 2021 LibreSprite Authors (cf. AUTHORS.md)
+// This file is released under the terms of the MIT license.
+// Read LICENSE.txt for more information.
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+
+#include <blender/Blender.hpp>
+
+#if defined(__clang__)
+#pragma clang attribute push (__attribute__((target("avx2"))), apply_to = function)
+#else
+#pragma GCC push_options
+#pragma GCC target("avx2")
+#endif
+
+#include <immintrin.h>
+#include <blender/BlendKernel.hpp>
+
+namespace {
+    struct AVX2Lane {
+        static constexpr U32 width = 8;
+        using Int = __m256i;
+
+        static Int load(const U32* src) {return _mm256_loadu_si256(reinterpret_cast<const __m256i*>(src));}
+        static Int loadBytes(const U8* src) {return _mm256_cvtepu8_epi32(_mm_loadl_epi64(reinterpret_cast<const __m128i*>(src)));}
+        static void store(U32* dst, Int v) {_mm256_storeu_si256(reinterpret_cast<__m256i*>(dst), v);}
+        static Int set(S32 v) {return _mm256_set1_epi32(v);}
+        static Int add(Int a, Int b) {return _mm256_add_epi32(a, b);}
+        static Int sub(Int a, Int b) {return _mm256_sub_epi32(a, b);}
+        // operands never exceed 16 bits, so the low 16-bit product is exact
+        static Int mul(Int a, Int b) {return _mm256_mullo_epi16(a, b);}
+        static Int shr(Int a, S32 bits) {return _mm256_srli_epi32(a, bits);}
+        static Int shl(Int a, S32 bits) {return _mm256_slli_epi32(a, bits);}
+        static Int bitAnd(Int a, Int b) {return _mm256_and_si256(a, b);}
+        static Int bitOr(Int a, Int b) {return _mm256_or_si256(a, b);}
+        static Int lessThan(Int a, Int b) {return _mm256_cmpgt_epi32(b, a);}
+        static Int equal(Int a, Int b) {return _mm256_cmpeq_epi32(a, b);}
+        static Int select(Int mask, Int a, Int b) {return _mm256_blendv_epi8(b, a, mask);}
+    };
+}
+
+BlendKernel getBlendKernelAVX2(BlendOp op) {
+    return blendKernelFor<AVX2Lane>(op);
+}
+
+#if defined(__clang__)
+#pragma clang attribute pop
+#else
+#pragma GCC pop_options
+#endif
+
+#endif
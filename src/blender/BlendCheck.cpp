@@ -0,0 +1,163 @@
+// Copyright (c) 2021 LibreSprite Authors (cf. AUTHORS.md)
+// This file is released under the terms of the MIT license.
+// Read LICENSE.txt for more information.
+
+// Standalone check of the fixed-point blend kernels, not part of the app.
+// Build and run it with `make -C src/blender check`. It compares every
+// mode against the float pipeline the kernels replaced, which must agree
+// within +/-1 per channel, and the SIMD kernels against the scalar ones,
+// which must agree exactly.
+
+#ifdef BLEND_CHECK
+
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <random>
+
+#include <blender/BlendKernel.hpp>
+
+namespace {
+
+    // The float blend, one pixel at a time, as it was before the switch
+    // to fixed point. blendChannel did not change.
+    template<BlendOp op>
+    U32 floatBlend(U32 low, U32 high, F32 alpha) {
+        auto channel = [](U32 pixel, U32 shift) {return S32((pixel >> shift) & 0xFF);};
+        S32 ar = channel(low, Color::Rshift), ag = channel(low, Color::Gshift);
+        S32 ab = channel(low, Color::Bshift), aa = channel(low, Color::Ashift);
+        S32 br = channel(high, Color::Rshift), bg = channel(high, Color::Gshift);
+        S32 bb = channel(high, Color::Bshift), ba = channel(high, Color::Ashift);
+
+        if (ba == 0)
+            return low;
+        if constexpr (op == BlendOp::Darken) {
+            if (ar + ag + ab < br + bg + bb + 1)
+                return low;
+        } else if constexpr (op == BlendOp::Lighten) {
+            if (br + bg + bb < ar + ag + ab + 1)
+                return low;
+        }
+
+        F32 t = alpha * (ba * (1.0f / 255.0f));
+        F32 it = 1.0f - t;
+        auto mix = [&](S32 a, S32 b) {
+            S32 f = blendChannel<op, ScalarLane>(a, b);
+            return U32(a * it + f * t + 0.5f) & 0xFF;
+        };
+
+        U32 a;
+        if constexpr (op == BlendOp::Erase) {
+            a = U32(aa * it + 0.5f) & 0xFF;
+        } else {
+            a = U32(aa + t * (255 - aa) + 0.5f) & 0xFF;
+        }
+
+        return (mix(ar, br) << Color::Rshift)
+            | (mix(ag, bg) << Color::Gshift)
+            | (mix(ab, bb) << Color::Bshift)
+            | (a << Color::Ashift);
+    }
+
+    // Largest difference between any two channels of a and b
+    U32 distance(U32 a, U32 b) {
+        U32 max = 0;
+        for (U32 shift = 0; shift < 32; shift += 8)
+            max = std::max<U32>(max, std::abs(S32((a >> shift) & 0xFF) - S32((b >> shift) & 0xFF)));
+        return max;
+    }
+
+    struct Result {
+        U64 pixels = 0;
+        U64 offByOne = 0;
+        U64 floatFailures = 0;
+        U64 laneFailures = 0;
+    };
+
+    void compare(Result& result, U32 fixed, U32 reference, U32 expected) {
+        result.pixels++;
+        result.laneFailures += fixed != reference;
+        U32 d = distance(reference, expected);
+        result.offByOne += d == 1;
+        result.floatFailures += d > 1;
+    }
+
+    // Random pixels, with the alpha channel biased towards the interesting
+    // ends: fully transparent, fully opaque and anything in between.
+    U32 randomPixel(std::mt19937& rng) {
+        U32 pixel = rng() & ~(U32{0xFF} << Color::Ashift);
+        U32 alpha;
+        switch (rng() % 4) {
+        case 0: alpha = 0; break;
+        case 1: alpha = 255; break;
+        default: alpha = rng() & 0xFF; break;
+        }
+        return pixel | (alpha << Color::Ashift);
+    }
+
+    template<BlendOp op>
+    Result check(std::mt19937& rng, U32 rounds) {
+        constexpr U32 count = 1024;
+        auto fast = getBlendKernel(op);
+        auto reference = getBlendKernel(op, true);
+        Vector<U32> low(count), high(count), out(count), ref(count);
+        Vector<U8> mask(count);
+        Result result;
+
+        for (U32 round = 0; round < rounds; ++round) {
+            for (U32 i = 0; i < count; ++i) {
+                low[i] = randomPixel(rng);
+                high[i] = randomPixel(rng);
+                mask[i] = rng() & 0xFF;
+            }
+
+            // Layer alpha arrives as a float and is quantized once per blend
+            F32 alpha = (rng() % 1001) / 1000.0f;
+            U8 fixedAlpha = Blender::toFixed(alpha);
+            fast.row(out.data(), low.data(), high.data(), count, fixedAlpha);
+            reference.row(ref.data(), low.data(), high.data(), count, fixedAlpha);
+            for (U32 i = 0; i < count; ++i)
+                compare(result, out[i], ref[i], floatBlend<op>(low[i], high[i], alpha));
+
+            // Painting blends a solid color through coverage / 255
+            U32 color = randomPixel(rng) | (U32{0xFF} << Color::Ashift);
+            fast.mask(out.data(), low.data(), color, mask.data(), count);
+            reference.mask(ref.data(), low.data(), color, mask.data(), count);
+            for (U32 i = 0; i < count; ++i)
+                compare(result, out[i], ref[i], floatBlend<op>(low[i], color, mask[i] * (1.0f / 255.0f)));
+        }
+        return result;
+    }
+
+    template<BlendOp op>
+    bool report(const char* name, std::mt19937& rng, U32 rounds) {
+        auto result = check<op>(rng, rounds);
+        printf("%-10s %10llu pixels, %9llu off by one, %llu off by more, %llu lane mismatches\n",
+               name,
+               (unsigned long long) result.pixels,
+               (unsigned long long) result.offByOne,
+               (unsigned long long) result.floatFailures,
+               (unsigned long long) result.laneFailures);
+        return !result.floatFailures && !result.laneFailures;
+    }
+
+}
+
+int main(int argc, char* argv[]) {
+    U32 rounds = argc > 1 ? std::atoi(argv[1]) : 1000;
+    std::mt19937 rng{1234};
+    bool ok = true;
+    ok &= report<BlendOp::Normal>("normal", rng, rounds);
+    ok &= report<BlendOp::Multiply>("multiply", rng, rounds);
+    ok &= report<BlendOp::Screen>("screen", rng, rounds);
+    ok &= report<BlendOp::Overlay>("overlay", rng, rounds);
+    ok &= report<BlendOp::Darken>("darken", rng, rounds);
+    ok &= report<BlendOp::Lighten>("lighten", rng, rounds);
+    ok &= report<BlendOp::HardLight>("hardlight", rng, rounds);
+    ok &= report<BlendOp::SoftLight>("softlight", rng, rounds);
+    ok &= report<BlendOp::Erase>("erase", rng, rounds);
+    puts(ok ? "OK" : "FAILED");
+    return ok ? 0 : 1;
+}
+
+#endif
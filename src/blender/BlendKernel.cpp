@@ -0,0 +1,41 @@
+// Copyright (c) 2021 LibreSprite Authors (cf. AUTHORS.md)
+// This file is released under the terms of the MIT license.
+// Read LICENSE.txt for more information.
+
+#include <blender/BlendKernel.hpp>
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define BLEND_X86
+BlendKernel getBlendKernelSSE2(BlendOp op);
+BlendKernel getBlendKernelAVX2(BlendOp op);
+#endif
+
+namespace {
+    enum class BlendISA {
+        Scalar,
+        SSE2,
+        AVX2
+    };
+
+    BlendISA detectISA() {
+#if defined(BLEND_X86)
+        __builtin_cpu_init();
+        if (__builtin_cpu_supports("avx2"))
+            return BlendISA::AVX2;
+        if (__builtin_cpu_supports("sse2"))
+            return BlendISA::SSE2;
+#endif
+        return BlendISA::Scalar;
+    }
+}
+
+BlendKernel getBlendKernel(BlendOp op, bool reference) {
+    static const BlendISA isa = detectISA();
+#if defined(BLEND_X86)
+    if (!reference && isa == BlendISA::AVX2)
+        return getBlendKernelAVX2(op);
+    if (!reference && isa == BlendISA::SSE2)
+        return getBlendKernelSSE2(op);
+#endif
+    return blendKernelFor<ScalarLane>(op);
+}
@@ -0,0 +1,175 @@
+// Copyright (c) 2021 LibreSprite Authors (cf. AUTHORS.md)
+// This file is released under the terms of the MIT license.
+// Read LICENSE.txt for more information.
+
+// Lane-generic blend kernels. Only included by the BlendKernel*.cpp units,
+// which compile it once per instruction set. Everything in here has internal
+// linkage so that code built for one instruction set never leaks into another.
+
+#pragma once
+
+#include <blender/Blender.hpp>
+
+namespace {
+
+    // One 32-bit lane per pixel. The SIMD units provide equivalent lane types
+    // holding 4 (SSE2) or 8 (AVX2) pixels.
+    struct ScalarLane {
+        static constexpr U32 width = 1;
+        using Int = S32;
+
+        static Int load(const U32* src) {return *src;}
+        static Int loadBytes(const U8* src) {return *src;}
+        static void store(U32* dst, Int v) {*dst = v;}
+        static Int set(S32 v) {return v;}
+        static Int add(Int a, Int b) {return a + b;}
+        static Int sub(Int a, Int b) {return a - b;}
+        static Int mul(Int a, Int b) {return a * b;} // operands never exceed 16 bits
+        static Int shr(Int a, S32 bits) {return U32(a) >> bits;}
+        static Int shl(Int a, S32 bits) {return U32(a) << bits;}
+        static Int bitAnd(Int a, Int b) {return a & b;}
+        static Int bitOr(Int a, Int b) {return a | b;}
+        static Int lessThan(Int a, Int b) {return a < b ? ~0 : 0;}
+        static Int equal(Int a, Int b) {return a == b ? ~0 : 0;}
+        static Int select(Int mask, Int a, Int b) {return (mask & a) | (~mask & b);}
+    };
+
+    // round(x / 255) for 0 <= x <= 255 * 255, without a division
+    template<typename Lane>
+    typename Lane::Int div255(typename Lane::Int x) {
+        x = Lane::add(x, Lane::set(128));
+        return Lane::shr(Lane::add(x, Lane::shr(x, 8)), 8);
+    }
+
+    template<typename Lane>
+    typename Lane::Int channelOf(typename Lane::Int pixel, U32 shift) {
+        return Lane::bitAnd(Lane::shr(pixel, shift), Lane::set(0xFF));
+    }
+
+    // The per-mode color function f(low, high), applied to one channel.
+    template<BlendOp op, typename Lane>
+    typename Lane::Int blendChannel(typename Lane::Int a, typename Lane::Int b) {
+        using L = Lane;
+        const auto c255 = L::set(255);
+        if constexpr (op == BlendOp::Multiply) {
+            return L::shr(L::mul(a, b), 8);
+        } else if constexpr (op == BlendOp::Screen) {
+            return L::sub(c255, L::shr(L::mul(L::sub(c255, a), L::sub(c255, b)), 8));
+        } else if constexpr (op == BlendOp::Overlay || op == BlendOp::HardLight) {
+            auto dark = L::shr(L::mul(a, b), 7);
+            auto light = L::sub(c255, L::shr(L::mul(L::sub(c255, a), L::sub(c255, b)), 7));
+            auto key = op == BlendOp::Overlay ? b : a;
+            return L::select(L::lessThan(key, L::set(128)), dark, light);
+        } else if constexpr (op == BlendOp::SoftLight) {
+            auto R = L::shr(L::mul(a, b), 8);
+            auto screen = L::shr(L::mul(L::sub(c255, a), L::sub(c255, b)), 8);
+            auto soft = L::shr(L::mul(a, L::sub(L::sub(c255, screen), R)), 8);
+            return L::bitAnd(L::add(R, soft), L::set(0xFF));
+        } else if constexpr (op == BlendOp::Erase) {
+            return L::set(0);
+        } else {
+            return b;
+        }
+    }
+
+    // `coverage` is the 0-255 opacity the high pixels are applied with.
+    template<BlendOp op, typename Lane>
+    typename Lane::Int blendLanes(typename Lane::Int low, typename Lane::Int high, typename Lane::Int coverage) {
+        using L = Lane;
+        auto ar = channelOf<L>(low, Color::Rshift);
+        auto ag = channelOf<L>(low, Color::Gshift);
+        auto ab = channelOf<L>(low, Color::Bshift);
+        auto aa = channelOf<L>(low, Color::Ashift);
+        auto br = channelOf<L>(high, Color::Rshift);
+        auto bg = channelOf<L>(high, Color::Gshift);
+        auto bb = channelOf<L>(high, Color::Bshift);
+        auto ba = channelOf<L>(high, Color::Ashift);
+
+        const auto c255 = L::set(255);
+        auto t = div255<L>(L::mul(coverage, ba));
+        auto it = L::sub(c255, t);
+
+        auto mix = [&](auto a, auto b) {
+            auto f = blendChannel<op, L>(a, b);
+            return div255<L>(L::add(L::mul(a, it), L::mul(f, t)));
+        };
+
+        auto r = mix(ar, br);
+        auto g = mix(ag, bg);
+        auto b = mix(ab, bb);
+        typename L::Int a;
+        if constexpr (op == BlendOp::Erase) {
+            a = div255<L>(L::mul(aa, it));
+        } else {
+            a = L::add(aa, div255<L>(L::mul(L::sub(c255, aa), t)));
+        }
+
+        auto out = L::bitOr(
+            L::bitOr(L::shl(r, Color::Rshift), L::shl(g, Color::Gshift)),
+            L::bitOr(L::shl(b, Color::Bshift), L::shl(a, Color::Ashift)));
+
+        // transparent source pixels leave the destination untouched
+        auto keep = L::equal(ba, L::set(0));
+
+        if constexpr (op == BlendOp::Darken || op == BlendOp::Lighten) {
+            auto sumA = L::add(L::add(ar, ag), ab);
+            auto sumB = L::add(L::add(br, bg), bb);
+            // darken only applies where the source is darker, lighten where it is lighter
+            auto skip = op == BlendOp::Darken ? L::lessThan(sumA, L::add(sumB, L::set(1)))
+                                              : L::lessThan(sumB, L::add(sumA, L::set(1)));
+            keep = L::bitOr(keep, skip);
+        }
+
+        return L::select(keep, low, out);
+    }
+
+    template<BlendOp op, typename Lane>
+    void blendRowLanes(U32* out, const U32* low, const U32* high, U32 count, U32 alpha) {
+        U32 x = 0;
+        if constexpr (Lane::width > 1) {
+            auto coverage = Lane::set(alpha);
+            for (; x + Lane::width <= count; x += Lane::width) {
+                Lane::store(out + x, blendLanes<op, Lane>(Lane::load(low + x), Lane::load(high + x), coverage));
+            }
+        }
+        for (; x < count; ++x) {
+            ScalarLane::store(out + x, blendLanes<op, ScalarLane>(low[x], high[x], alpha));
+        }
+    }
+
+    template<BlendOp op, typename Lane>
+    void blendMaskLanes(U32* out, const U32* low, U32 color, const U8* mask, U32 count) {
+        U32 x = 0;
+        if constexpr (Lane::width > 1) {
+            auto high = Lane::set(color);
+            for (; x + Lane::width <= count; x += Lane::width) {
+                Lane::store(out + x, blendLanes<op, Lane>(Lane::load(low + x), high, Lane::loadBytes(mask + x)));
+            }
+        }
+        for (; x < count; ++x) {
+            ScalarLane::store(out + x, blendLanes<op, ScalarLane>(low[x], color, mask[x]));
+        }
+    }
+
+    template<BlendOp op, typename Lane>
+    BlendKernel kernelOf() {
+        return {blendRowLanes<op, Lane>, blendMaskLanes<op, Lane>};
+    }
+
+    template<typename Lane>
+    BlendKernel blendKernelFor(BlendOp op) {
+        switch (op) {
+        case BlendOp::Normal: return kernelOf<BlendOp::Normal, Lane>();
+        case BlendOp::Multiply: return kernelOf<BlendOp::Multiply, Lane>();
+        case BlendOp::Screen: return kernelOf<BlendOp::Screen, Lane>();
+        case BlendOp::Overlay: return kernelOf<BlendOp::Overlay, Lane>();
+        case BlendOp::Darken: return kernelOf<BlendOp::Darken, Lane>();
+        case BlendOp::Lighten: return kernelOf<BlendOp::Lighten, Lane>();
+        case BlendOp::HardLight: return kernelOf<BlendOp::HardLight, Lane>();
+        case BlendOp::SoftLight: return kernelOf<BlendOp::SoftLight, Lane>();
+        case BlendOp::Erase: return kernelOf<BlendOp::Erase, Lane>();
+        }
+        return kernelOf<BlendOp::Normal, Lane>();
+    }
+
+}
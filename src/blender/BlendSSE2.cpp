@@ -0,0 +1,59 @@
+// Copyright (c) 2021 LibreSprite Authors (cf. AUTHORS.md)
+// This file is released under the terms of the MIT license.
+// Read LICENSE.txt for more information.
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+
+#include <cstring>
+
+#include <blender/Blender.hpp>
+
+#if defined(__clang__)
+#pragma clang attribute push (__attribute__((target("sse2"))), apply_to = function)
+#else
+#pragma GCC push_options
+#pragma GCC target("sse2")
+#endif
+
+#include <emmintrin.h>
+#include <blender/BlendKernel.hpp>
+
+namespace {
+    struct SSE2Lane {
+        static constexpr U32 width = 4;
+        using Int = __m128i;
+
+        static Int load(const U32* src) {return _mm_loadu_si128(reinterpret_cast<const __m128i*>(src));}
+        static Int loadBytes(const U8* src) {
+            S32 bytes;
+            std::memcpy(&bytes, src, sizeof(bytes));
+            auto zero = _mm_setzero_si128();
+            return _mm_unpacklo_epi16(_mm_unpacklo_epi8(_mm_cvtsi32_si128(bytes), zero), zero);
+        }
+        static void store(U32* dst, Int v) {_mm_storeu_si128(reinterpret_cast<__m128i*>(dst), v);}
+        static Int set(S32 v) {return _mm_set1_epi32(v);}
+        static Int add(Int a, Int b) {return _mm_add_epi32(a, b);}
+        static Int sub(Int a, Int b) {return _mm_sub_epi32(a, b);}
+        // operands never exceed 16 bits, so the low 16-bit product is exact
+        static Int mul(Int a, Int b) {return _mm_mullo_epi16(a, b);}
+        static Int shr(Int a, S32 bits) {return _mm_srli_epi32(a, bits);}
+        static Int shl(Int a, S32 bits) {return _mm_slli_epi32(a, bits);}
+        static Int bitAnd(Int a, Int b) {return _mm_and_si128(a, b);}
+        static Int bitOr(Int a, Int b) {return _mm_or_si128(a, b);}
+        static Int lessThan(Int a, Int b) {return _mm_cmplt_epi32(a, b);}
+        static Int equal(Int a, Int b) {return _mm_cmpeq_epi32(a, b);}
+        static Int select(Int mask, Int a, Int b) {return _mm_or_si128(_mm_and_si128(mask, a), _mm_andnot_si128(mask, b));}
+    };
+}
+
+BlendKernel getBlendKernelSSE2(BlendOp op) {
+    return blendKernelFor<SSE2Lane>(op);
+}
+
+#if defined(__clang__)
+#pragma clang attribute pop
+#else
+#pragma GCC pop_options
+#endif
+
+#endif
@@ -4,33 +4,72 @@
 
 #pragma once
 
+#include <algorithm>
 #include <memory>
 
 #include <common/inject.hpp>
 #include <common/Surface.hpp>
 #include <common/Profiler.hpp>
 
+enum class BlendOp {
+    Normal,
+    Multiply,
+    Screen,
+    Overlay,
+    Darken,
+    Lighten,
+    HardLight,
+    SoftLight,
+    Erase
+};
+
+// All blending is done in 8-bit fixed point: coverage and alpha values are
+// in the 0-255 range and every product is rounded back with an exact x/255.
+struct BlendKernel {
+    // Blends `count` pixels of `high` over `low` into `out` with a constant `alpha`.
+    // `out` may alias `low` or `high`.
+    void (*row)(U32* out, const U32* low, const U32* high, U32 count, U32 alpha);
+
+    // Blends a solid `color` over `low` into `out`, with per-pixel coverage from `mask`.
+    void (*mask)(U32* out, const U32* low, U32 color, const U8* mask, U32 count);
+};
+
+// Returns the fastest kernels the CPU supports.
+// With `reference` set, always returns the portable scalar kernels.
+BlendKernel getBlendKernel(BlendOp op, bool reference = false);
+
 class Blender : public Injectable<Blender>, public std::enable_shared_from_this<Blender> {
 public:
-    static inline Color color;
-    virtual Surface::PixelType blendPixel(const Color& a, const Color& b, F32 alpha) = 0;
+    static U8 toFixed(F32 alpha) {
+        return std::clamp(alpha, 0.0f, 1.0f) * 255.0f + 0.5f;
+    }
+
+    virtual void blendRow(U32* out, const U32* low, const U32* high, U32 count, U8 alpha) = 0;
+    virtual void blendMask(U32* out, const U32* low, U32 color, const U8* mask, U32 count) = 0;
+
     virtual void blend(Surface* result, Surface* low, Surface* high, F32 alpha, const Rect& area) {
         PROFILER;
         auto a = low->data(), b = high->data(), c = result->data();
         U32 stride = result->width();
-        Color ca, cb;
+        U8 fixedAlpha = toFixed(alpha);
         for (U32 y = 0; y < area.height; ++y) {
             U32 i = (y + area.y) * stride + area.x;
-            for (U32 x = 0; x < area.width; ++x) {
-                cb.fromU32(b[i + x]);
-                if (cb.a) {
-                    ca.fromU32(a[i + x]);
-                    c[i + x] = blendPixel(ca, cb, alpha);
-                } else {
-                    c[i + x] = a[i + x];
-                }
-            }
+            blendRow(c + i, a + i, b + i, area.width, fixedAlpha);
         }
         result->setDirty(result->rect());
     }
 };
+
+template<BlendOp op>
+class BlenderImpl : public Blender {
+    BlendKernel kernel = getBlendKernel(op);
+
+public:
+    void blendRow(U32* out, const U32* low, const U32* high, U32 count, U8 alpha) override {
+        kernel.row(out, low, high, count, alpha);
+    }
+
+    void blendMask(U32* out, const U32* low, U32 color, const U8* mask, U32 count) override {
+        kernel.mask(out, low, color, mask, count);
+    }
+};
@@ -4,16 +4,6 @@
 
 #include <blender/Blender.hpp>
 
-class Normal : public Blender {
-public:
-    Surface::PixelType blendPixel(const Color& a, const Color& b, F32 alpha) override {
-        alpha *= b.a * (1.0f / 255.0f);
-        color.r = a.r * (1 - alpha) + b.r * alpha + 0.5f;
-        color.g = a.g * (1 - alpha) + b.g * alpha + 0.5f;
-        color.b = a.b * (1 - alpha) + b.b * alpha + 0.5f;
-        color.a = a.a + alpha * (255 - a.a) + 0.5f;
-        return color.toU32();
-    }
-};
+class Normal : public BlenderImpl<BlendOp::Normal> {};
 
 static Blender::Shared<Normal> reg{"normal"};
@@ -2,22 +2,35 @@
 // This file is released under the terms of the MIT license.
 // Read LICENSE.txt for more information.
 
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <optional>
+
 #include <cmd/Command.hpp>
+#include <common/Color.hpp>
 #include <common/FunctionRef.hpp>
 #include <common/Messages.hpp>
+#include <common/PixelDelta.hpp>
 #include <common/PubSub.hpp>
 #include <common/String.hpp>
+#include <common/Surface.hpp>
+#include <doc/BitmapCell.hpp>
 #include <doc/Cell.hpp>
+#include <doc/Selection.hpp>
 #include <doc/Timeline.hpp>
 #include <log/Log.hpp>
 #include <filters/Filter.hpp>
 #include <gui/Node.hpp>
 #include <gui/Unit.hpp>
+#include <task/TaskManager.hpp>
 
 class ActivateFilter : public Command {
     Property<String> filter{this, "filter"};
     Property<bool> interactive{this, "interactive"};
     PubSub<> pub{this};
+    // Only subscribed while a batch or a preview is running
+    std::optional<PubSub<msg::Tick>> tickpub;
     std::weak_ptr<ui::Node> menu;
 
     U32 frame, layer;
@@ -33,29 +46,184 @@ class ActivateFilter : public Command {
 
     U32 undoSize() {return layerCount() * frameCount();}
 
-    Vector<std::shared_ptr<Surface>> undoData;
+    // A filter that keeps the surface size only needs the delta,
+    // one that resizes it keeps the old surface. When rect is not empty
+    // the delta only covers the pixels inside it. A spilled old surface
+    // becomes a delta against black, of beforeWidth x beforeHeight.
+    struct UndoEntry {
+        std::shared_ptr<Surface> before;
+        PixelDelta delta;
+        Rect rect;
+        U32 beforeWidth = 0;
+        U32 beforeHeight = 0;
+    };
+    Vector<UndoEntry> undoData;
     std::shared_ptr<PropertySet> filterUndoData;
 
-public:
-    U32 commitSize() override {return undoSize();}
+    // A copy of the active cell's selection, for filters that can be
+    // limited to it. Kept for redo.
+    std::shared_ptr<Selection> mask;
+    Rect roi;
 
-    void undo() override {
-        auto doc = this->doc();
-        auto timeline = doc->currentTimeline();
-        U32 stride = allFrames ? (allLayers ? timeline->layerCount() : 1) : 0;
+    struct Job {
+        std::shared_ptr<Surface> surface;
+        UndoEntry* entry;
+    };
+
+    // Cells of a thread-safe filter run on the TaskManager, a few per
+    // round, so that progress and cancellation are seen in between.
+    static constexpr U32 batchRound = 8;
+    struct Batch {
+        std::shared_ptr<Filter> filter;
+        std::shared_ptr<Selection> mask;
+        Rect roi;
+        Vector<Job> jobs;
+        Vector<std::unique_ptr<Surface::WriteScope>> writes;
+        std::atomic<U32> finished = 0;
+        std::atomic_bool cancelled = false;
+        // A redo is already in the history, so it can't be cancelled
+        bool redo = false;
+    };
+    std::shared_ptr<Batch> batch;
+    TaskHandle task;
+    std::optional<EditLock> editLock;
+    std::weak_ptr<ui::Node> progress;
+    bool redoing = false;
+
+    // While the interactive menu is open, the filter runs on a downsampled
+    // copy of the active cell each time its parameters settle. The copy
+    // has about as many pixels as the active editor shows of the cell, and
+    // never fewer than previewSize on its longer side.
+    static constexpr U32 previewSize = 256;
+    static constexpr U32 previewDelay = 150; // milliseconds
+    std::shared_ptr<Surface> proxy;
+    std::shared_ptr<Surface> preview;
+    F32 proxyScale = 1;
+    std::shared_ptr<PropertySet> previewParams;
+    std::chrono::steady_clock::time_point previewChanged;
+    bool previewPending = false;
+    TaskHandle previewTask;
+
+    template<typename Callback>
+    void eachCell(Timeline& timeline, Callback&& callback) {
+        U32 stride = allFrames ? (allLayers ? timeline.layerCount() : 1) : 0;
         for (U32 frame = startFrame(); frame != endFrame(); ++frame) {
             for (U32 layer = startLayer(); layer != endLayer(); ++layer) {
-                auto cell = timeline->getCell(frame, layer);
+                auto cell = timeline.getCell(frame, layer);
                 if (!cell)
                     continue;
                 auto surface = cell->getComposite();
                 if (!surface)
                     continue;
-                if (auto data = undoData[(frame - startFrame()) * stride + (layer - startLayer())]) {
-                    *surface = *data;
-                }
+                callback(*surface, undoData[(frame - startFrame()) * stride + (layer - startLayer())]);
             }
         }
+    }
+
+    static Vector<Surface::PixelType> readRect(Surface& surface, const Rect& rect) {
+        Vector<Surface::PixelType> pixels(rect.width * rect.height);
+        auto data = surface.data();
+        for (U32 y = 0; y < rect.height; ++y) {
+            auto row = data + (rect.y + y) * surface.width() + rect.x;
+            std::copy(row, row + rect.width, pixels.data() + y * rect.width);
+        }
+        return pixels;
+    }
+
+    static void writeRect(Surface& surface, const Rect& rect, const Vector<Surface::PixelType>& pixels) {
+        auto data = surface.data();
+        for (U32 y = 0; y < rect.height; ++y) {
+            auto row = pixels.data() + y * rect.width;
+            std::copy(row, row + rect.width, data + (rect.y + y) * surface.width() + rect.x);
+        }
+        surface.setDirty(rect);
+    }
+
+    static void filterCell(Filter& filter, Surface& surface, UndoEntry& entry, const Selection* mask, const Rect& roi) {
+        if (mask) {
+            entry.rect = roi;
+            entry.rect.intersect(surface.rect());
+            auto before = readRect(surface, entry.rect);
+            filter.runRegion(surface.shared_from_this(), entry.rect, *mask);
+            auto after = readRect(surface, entry.rect);
+            entry.delta = PixelDelta{before.data(), after.data(), U32(before.size())};
+            return;
+        }
+
+        entry.before = surface.clone();
+        filter.run(surface.shared_from_this());
+        if (entry.before->width() == surface.width() && entry.before->height() == surface.height()) {
+            auto& before = entry.before->getPixels();
+            entry.delta = PixelDelta{before.data(), surface.data(), U32(before.size())};
+            entry.before.reset();
+        }
+    }
+
+    static void restoreCell(Surface& surface, UndoEntry& entry) {
+        if (entry.before) {
+            surface = *entry.before;
+        } else if (entry.beforeWidth) {
+            surface.resize(entry.beforeWidth, entry.beforeHeight);
+            auto data = surface.data();
+            U32 count = entry.beforeWidth * entry.beforeHeight;
+            std::fill(data, data + count, 0);
+            entry.delta.apply(data, count);
+            surface.setDirty(surface.rect());
+        } else if (!entry.rect.empty()) {
+            auto pixels = readRect(surface, entry.rect);
+            entry.delta.apply(pixels.data(), pixels.size());
+            writeRect(surface, entry.rect, pixels);
+        } else if (entry.delta.size()) {
+            entry.delta.apply(surface.data(), surface.width() * surface.height());
+            surface.setDirty(surface.rect());
+        }
+    }
+
+public:
+    U32 commitSize() override {return undoSize();}
+
+    U64 memoryUsage() override {
+        U64 total = 0;
+        for (auto& entry : undoData) {
+            total += entry.delta.memoryUsage();
+            if (entry.before)
+                total += entry.before->dataSize();
+        }
+        return total;
+    }
+
+    void spill(const std::shared_ptr<Journal>& journal) override {
+        for (auto& entry : undoData) {
+            if (entry.before) {
+                auto& pixels = entry.before->getPixels();
+                Vector<Surface::PixelType> black(pixels.size());
+                PixelDelta delta{black.data(), pixels.data(), U32(pixels.size())};
+                if (!delta.spill(journal))
+                    continue;
+                entry.delta = std::move(delta);
+                entry.beforeWidth = entry.before->width();
+                entry.beforeHeight = entry.before->height();
+                entry.before.reset();
+            } else {
+                entry.delta.spill(journal);
+            }
+        }
+    }
+
+    bool prepareUndo() override {
+        for (auto& entry : undoData) {
+            if (!entry.delta.load())
+                return false;
+        }
+        return true;
+    }
+
+    void undo() override {
+        auto doc = this->doc();
+        auto timeline = doc->currentTimeline();
+        eachCell(*timeline, [](Surface& surface, UndoEntry& entry) {
+            restoreCell(surface, entry);
+        });
 
         if (filterUndoData) {
             auto it = Filter::instances.find(tolower(filter));
@@ -96,12 +264,24 @@ public:
             return;
         }
 
+        if (isBusy())
+            return;
+
         set("document", doc.get());
         filter->load(getPropertySet());
         filter->beforeRun();
 
         if (interactive) {
             if (auto meta = filter->getMetaProperties()) {
+                proxy.reset();
+                if (filter->isThreadSafe()) {
+                    if (auto cell = timeline->getCell()) {
+                        if (auto surface = cell->getComposite())
+                            buildProxy(*surface);
+                    }
+                }
+                if (proxy)
+                    tickpub.emplace(this);
                 showMenu(meta);
                 return;
             }
@@ -111,12 +291,10 @@ public:
         allLayers = filter->allLayers;
         frame = allFrames ? timeline->frameCount() : timeline->frame();
         layer = allLayers ? timeline->layerCount() : timeline->layer();
-        U32 stride = allFrames ? (allLayers ? timeline->layerCount() : 1) : 0;
 
-        bool hasUndoData = undoData.size() == undoSize();
-        if (!hasUndoData) {
-            undoData.resize(undoSize());
-        }
+        // redo runs the filter again, so the deltas are always recaptured
+        undoData.clear();
+        undoData.resize(undoSize());
 
         logV("Running ", *this->filter, " on ",
              (allFrames ? "all frames " : "frame " + std::to_string(frame)),
@@ -125,29 +303,309 @@ public:
 
         filter->undoData = nullptr;
 
-        for (U32 frame = startFrame(); frame != endFrame(); ++frame) {
-            for (U32 layer = startLayer(); layer != endLayer(); ++layer) {
-                auto cell = timeline->getCell(frame, layer);
-                if (!cell)
-                    continue;
-                auto surface = cell->getComposite();
-                if (!surface)
-                    continue;
-                if (!hasUndoData) {
-                    undoData[(frame - startFrame()) * stride + (layer - startLayer())] = surface->clone();
-                }
-                filter->run(surface->shared_from_this());
+        if (!redoing) {
+            mask.reset();
+            auto cell = std::dynamic_pointer_cast<BitmapCell>(timeline->getCell());
+            auto selection = cell ? cell->getSelection() : nullptr;
+            if (filter->supportsRegion() && selection && !selection->empty()) {
+                mask = inject<Selection>{"rle"}.shared();
+                *mask = *selection;
+                roi = mask->getTrimmedBounds();
             }
         }
 
-        filter->afterRun();
+        Vector<Job> jobs;
+        eachCell(*timeline, [&](Surface& surface, UndoEntry& entry) {
+            jobs.push_back({surface.shared_from_this(), &entry});
+        });
+
+        inject<TaskManager> taskman{InjectSilent::Yes};
+        if (taskman && filter->isThreadSafe() && jobs.size() > 1) {
+            startBatch(*taskman, filter, std::move(jobs));
+            return;
+        }
+
+        for (auto& job : jobs)
+            filterCell(*filter, *job.surface, *job.entry, mask.get(), roi);
+        finish(*filter);
+    }
+
+    void redo() override {
+        redoing = true;
+        run();
+        redoing = false;
+    }
 
-        filterUndoData = filter->undoData;
+    void finish(Filter& filter) {
+        filter.afterRun();
+
+        filterUndoData = filter.undoData;
         commit();
 
-        doc.reset();
+        std::shared_ptr<Document> doc;
         set("document", doc.get());
-        filter->set("document", doc.get());
+        filter.set("document", doc.get());
+    }
+
+    void startBatch(TaskManager& taskman, std::shared_ptr<Filter> filter, Vector<Job>&& jobs) {
+        auto batch = std::make_shared<Batch>();
+        batch->filter = filter;
+        batch->mask = mask;
+        batch->roi = roi;
+        batch->jobs = std::move(jobs);
+        batch->redo = redoing;
+        for (auto& job : batch->jobs) {
+            // Materialize tiled surfaces here, so the workers only write
+            // pixels and never swap the storage out from under a reader.
+            job.surface->data();
+            // setDirty from the workers lands in the scopes, which are
+            // closed back on this thread.
+            batch->writes.push_back(std::make_unique<Surface::WriteScope>(*job.surface));
+        }
+
+        this->batch = batch;
+        editLock.emplace(doc()->getEditLock());
+        Filter::active = filter;
+        showProgress();
+        tickpub.emplace(this);
+
+        auto shared = std::static_pointer_cast<ActivateFilter>(shared_from_this());
+        task = taskman.add([batch]() -> Value {
+                U32 begin = batch->finished;
+                U32 end = std::min<U32>(begin + batchRound, batch->jobs.size());
+                if (batch->cancelled)
+                    return false;
+                inject<TaskManager>{}->parallelFor(begin, end, 1, [&](U32 first, U32 last) {
+                    for (U32 i = first; i < last; ++i) {
+                        auto& job = batch->jobs[i];
+                        filterCell(*batch->filter, *job.surface, *job.entry, batch->mask.get(), batch->roi);
+                    }
+                });
+                batch->finished = end;
+                if (end < batch->jobs.size())
+                    return {};
+                return true;
+            }, [shared](Value&&) {
+                shared->finishBatch();
+            });
+    }
+
+    void finishBatch() {
+        auto batch = std::move(this->batch);
+        task.reset();
+
+        if (batch->cancelled) {
+            logV("Cancelled ", *filter, " after ", U32(batch->finished), " cells");
+            for (U32 i = 0; i < batch->finished; ++i)
+                restoreCell(*batch->jobs[i].surface, *batch->jobs[i].entry);
+        }
+
+        // publishes the dirty regions collected while the workers ran
+        batch->writes.clear();
+        editLock.reset();
+        Filter::active.reset();
+        if (auto progress = this->progress.lock())
+            progress->remove();
+        if (!proxy)
+            tickpub.reset();
+
+        if (batch->cancelled) {
+            undoData.clear();
+            std::shared_ptr<Document> doc;
+            set("document", doc.get());
+            batch->filter->set("document", doc.get());
+            return;
+        }
+
+        finish(*batch->filter);
+    }
+
+    void on(msg::Tick&) {
+        updatePreview();
+        if (!batch)
+            return;
+        auto progress = this->progress.lock();
+        if (!progress)
+            return;
+        if (auto label = progress->findChildById("progress")) {
+            U32 percent = batch->finished * 100 / batch->jobs.size();
+            label->set("label", std::to_string(percent) + "%");
+        }
+    }
+
+    void showProgress() {
+        auto metamenu = ui::Node::fromXML("metamenu");
+        if (!metamenu) {
+            logE("Could not create metamenu");
+            return;
+        }
+        progress = metamenu;
+
+        auto meta = std::make_shared<PropertySet>();
+        meta->push(std::make_shared<PropertySet>(PropertySet{
+                    {"widget", "row"},
+                    {"id", "progressrow"}
+                }));
+
+        meta->push(std::make_shared<PropertySet>(PropertySet{
+                    {"widget", "textbutton"},
+                    {"parent", "progressrow"},
+                    {"id", "progress"},
+                    {"label", "0%"}
+                }));
+
+        if (batch->redo) {
+            metamenu->set("meta", meta);
+            return;
+        }
+
+        std::weak_ptr<Batch> weakBatch = batch;
+        meta->push(std::make_shared<PropertySet>(PropertySet{
+                    {"widget", "textbutton"},
+                    {"parent", "progressrow"},
+                    {"label", "cancel"},
+                    {"click", FunctionRef<void()>([=]{
+                        if (auto batch = weakBatch.lock())
+                            batch->cancelled = true;
+                    })}
+                }));
+
+        metamenu->set("meta", meta);
+    }
+
+    // Size of the cell as the active editor shows it, clipped to the editor.
+    // previewSize x previewSize when there is no editor.
+    std::pair<F32, F32> previewLimit(Surface& source) {
+        F32 width = previewSize, height = previewSize;
+        auto editor = pub(msg::PollActiveEditor{}).editor;
+        if (!editor)
+            return {width, height};
+        F32 scale = 1;
+        if (auto value = editor->get("scale"); value && value->has<F32>())
+            scale = value->get<F32>();
+        auto& viewport = editor->globalRect;
+        width = std::max<F32>(width, std::min<F32>(viewport.width, source.width() * scale));
+        height = std::max<F32>(height, std::min<F32>(viewport.height, source.height() * scale));
+        return {width, height};
+    }
+
+    // Averages step x step blocks of source, weighting the color by alpha
+    // so transparent pixels don't darken the edges.
+    void buildProxy(Surface& source) {
+        auto [limitWidth, limitHeight] = previewLimit(source);
+        U32 step = std::ceil(std::max(source.width() / limitWidth, source.height() / limitHeight));
+        step = std::max<U32>(step, 1);
+        U32 width = (source.width() + step - 1) / step;
+        U32 height = (source.height() + step - 1) / step;
+        if (!width || !height)
+            return;
+
+        proxy = std::make_shared<Surface>();
+        proxy->resize(width, height);
+        auto src = source.data();
+        auto dst = proxy->data();
+        if (step == 1) {
+            std::copy(src, src + width * height, dst);
+        } else {
+            for (U32 y = 0; y < height; ++y) {
+                U32 bottom = std::min((y + 1) * step, source.height());
+                for (U32 x = 0; x < width; ++x) {
+                    U32 right = std::min((x + 1) * step, source.width());
+                    U64 r = 0, g = 0, b = 0, a = 0, count = 0;
+                    for (U32 sy = y * step; sy < bottom; ++sy) {
+                        auto row = src + sy * source.width();
+                        for (U32 sx = x * step; sx < right; ++sx) {
+                            auto pixel = row[sx];
+                            U32 alpha = (pixel >> Color::Ashift) & 0xFF;
+                            r += ((pixel >> Color::Rshift) & 0xFF) * alpha;
+                            g += ((pixel >> Color::Gshift) & 0xFF) * alpha;
+                            b += ((pixel >> Color::Bshift) & 0xFF) * alpha;
+                            a += alpha;
+                            count++;
+                        }
+                    }
+                    *dst++ = a ? Color{U8(r / a), U8(g / a), U8(b / a), U8(a / count)}.toU32() : 0;
+                }
+            }
+        }
+        proxyScale = 1.0f / step;
+
+        preview = std::make_shared<Surface>();
+        *preview = *proxy;
+        previewParams.reset();
+        previewPending = false;
+    }
+
+    static bool sameParams(const PropertySet& a, const PropertySet& b) {
+        auto& map = a.getMap();
+        if (map.size() != b.getMap().size())
+            return false;
+        for (auto& entry : map) {
+            auto other = b.getMap().find(entry.first);
+            if (other == b.getMap().end() || !(*entry.second == *other->second))
+                return false;
+        }
+        return true;
+    }
+
+    void updatePreview() {
+        if (!proxy)
+            return;
+
+        auto menu = this->menu.lock();
+        if (!menu) {
+            previewTask.reset();
+            previewParams.reset();
+            proxy.reset();
+            preview.reset();
+            if (!batch)
+                tickpub.reset();
+            return;
+        }
+
+        auto now = std::chrono::steady_clock::now();
+        auto params = std::make_shared<PropertySet>();
+        menu->set("result", params);
+        if (!previewParams || !sameParams(*params, *previewParams)) {
+            // restart the delay, and drop a preview of stale parameters
+            previewParams = params;
+            previewChanged = now;
+            previewPending = true;
+            previewTask.reset();
+            return;
+        }
+
+        if (!previewPending || now - previewChanged < std::chrono::milliseconds(previewDelay))
+            return;
+        previewPending = false;
+
+        inject<TaskManager> taskman{InjectSilent::Yes};
+        if (!taskman)
+            return;
+
+        // A fresh instance, so the worker never sees the menu's filter
+        // being reloaded.
+        auto filter = inject<Filter>{tolower(this->filter)}.shared();
+        if (!filter)
+            return;
+        filter->load(getPropertySet());
+        filter->load(*params);
+        filter->previewScale = proxyScale;
+
+        auto proxy = this->proxy;
+        auto preview = this->preview;
+        previewTask = taskman->add([=]() -> Value {
+                auto result = std::make_shared<Surface>();
+                result->resize(proxy->width(), proxy->height());
+                auto& pixels = proxy->getPixels();
+                std::copy(pixels.begin(), pixels.end(), result->data());
+                filter->run(result);
+                return result;
+            }, [=](Value&& value) {
+                std::shared_ptr<Surface> result = value;
+                if (result)
+                    *preview = *result;
+            });
     }
 
     void showMenu(std::shared_ptr<PropertySet> meta) {
@@ -156,6 +614,14 @@ public:
             logE("Could not create metamenu");
             return;
         }
+        menu = metamenu;
+
+        if (preview) {
+            meta->push(std::make_shared<PropertySet>(PropertySet{
+                        {"widget", "filterpreview"},
+                        {"surface", preview}
+                    }));
+        }
 
         meta->push(std::make_shared<PropertySet>(PropertySet{
                     {"widget", "row"},
@@ -167,6 +633,7 @@ public:
                     {"parent", "okcancel"},
                     {"label", "cancel"},
                     {"click", FunctionRef<void()>([=]{
+                        previewTask.reset();
                         metamenu->remove();
                     })}
                 }));
@@ -180,6 +647,7 @@ public:
                         auto ps = std::make_shared<PropertySet>();
                         metamenu->set("result", ps);
                         metamenu->remove();
+                        previewTask.reset();
                         shared->load(*ps);
                         interactive.value = false;
                         shared->run();
@@ -28,7 +28,7 @@ public:
     }
 
     void run() override {
-        if (!doc())
+        if (!doc() || isBusy())
             return;
         auto timeline = doc()->currentTimeline();
         if (!timeline)
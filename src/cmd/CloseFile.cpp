@@ -12,6 +12,8 @@
 class CloseFile : public Command {
 public:
     void run() override {
+        if (isBusy())
+            return;
         inject<ui::Node> editor{"activeeditor"};
         // TODO: check if the file needs to be saved first
         if (editor) {
@@ -8,6 +8,9 @@
 #include <common/PropertySet.hpp>
 #include <doc/Document.hpp>
 #include <doc/Timeline.hpp>
+#include <log/Log.hpp>
+
+class Journal;
 
 class Command : public Injectable<Command>,
                 public Model,
@@ -38,8 +41,24 @@ public:
     std::shared_ptr<Cell> cell() {return weakCell.lock();}
 
     bool committed() {return wasCommitted;}
+    // True while a background job holds the document's EditLock. Commands
+    // that change the document or read its cells refuse to run then.
+    bool isBusy() {
+        auto doc = weakDoc.lock();
+        if (!doc || !doc->isLocked())
+            return false;
+        logI("Document is busy");
+        return true;
+    }
     virtual U32 commitSize() {return 1;}
+    // Bytes of undo data held while the command is in the history
+    virtual U64 memoryUsage() {return 0;}
+    // Moves undo data to journal so that it no longer counts as memory usage
+    virtual void spill(const std::shared_ptr<Journal>& journal) {}
     virtual void run() = 0;
+    // Brings spilled undo data back before undo. Returning false refuses
+    // the undo and leaves the command where it is in the history.
+    virtual bool prepareUndo() {return true;}
     virtual void undo() {};
     virtual void redo() {run();}
 };
@@ -67,7 +67,7 @@ public:
     }
 
     void run() override {
-        if (!doc())
+        if (!doc() || isBusy())
             return;
 
         if (cells.empty()) {
@@ -5,17 +5,78 @@
 #include <blender/Blender.hpp>
 #include <cmd/Command.hpp>
 #include <common/Messages.hpp>
+#include <common/PixelDelta.hpp>
 #include <common/PubSub.hpp>
 #include <doc/BitmapCell.hpp>
 #include <doc/Selection.hpp>
 #include <log/Log.hpp>
 #include <tools/Tool.hpp>
 
+// Pixels of the surface being previewed as they were before the preview.
+// Only the tiles flagged in backupTiles have been copied, backupRect covers them.
 static std::shared_ptr<Surface> backup;
+static Vector<bool> backupTiles;
+static Rect backupRect;
+static constexpr U32 backupTileSize = 64;
 static Surface::PixelType* backupSurface = nullptr;
 static std::shared_ptr<Selection> backupSelection;
 static Vector<U32> cursorUndo;
 
+static void startBackup(Surface* surface) {
+    if (!backup)
+        backup = std::make_shared<Surface>();
+    backup->resize(surface->width(), surface->height());
+    U32 columns = (surface->width() + backupTileSize - 1) / backupTileSize;
+    U32 rows = (surface->height() + backupTileSize - 1) / backupTileSize;
+    backupTiles.assign(columns * rows, false);
+    backupRect = Rect{};
+}
+
+// Copies the tiles of surface that overlap rect into backup, unless they already are
+static void backupRegion(Surface* surface, Rect rect) {
+    rect.intersect(surface->rect());
+    if (rect.empty())
+        return;
+    U32 width = surface->width();
+    U32 columns = (width + backupTileSize - 1) / backupTileSize;
+    auto surfaceData = surface->data();
+    auto backupData = backup->data();
+    for (U32 row = rect.y / backupTileSize, lastRow = (rect.bottom() - 1) / backupTileSize; row <= lastRow; ++row) {
+        for (U32 column = rect.x / backupTileSize, lastColumn = (rect.right() - 1) / backupTileSize; column <= lastColumn; ++column) {
+            auto tileIndex = row * columns + column;
+            if (backupTiles[tileIndex])
+                continue;
+            backupTiles[tileIndex] = true;
+            Rect tile{S32(column * backupTileSize), S32(row * backupTileSize), backupTileSize, backupTileSize};
+            tile.intersect(surface->rect());
+            for (S32 y = tile.y; y < tile.bottom(); ++y) {
+                auto offset = y * width + tile.x;
+                std::copy(surfaceData + offset, surfaceData + offset + tile.width, backupData + offset);
+            }
+            backupRect.expand(tile.x, tile.y);
+            backupRect.expand(tile.right() - 1, tile.bottom() - 1);
+        }
+    }
+}
+
+// Calls callback(tile) with the rect of each tile that is in backup
+template<typename Callback>
+static void eachBackupTile(Surface* surface, Callback&& callback) {
+    U32 columns = (surface->width() + backupTileSize - 1) / backupTileSize;
+    for (U32 tileIndex = 0; tileIndex < backupTiles.size(); ++tileIndex) {
+        if (!backupTiles[tileIndex])
+            continue;
+        Rect tile{
+            S32(tileIndex % columns * backupTileSize),
+            S32(tileIndex / columns * backupTileSize),
+            backupTileSize,
+            backupTileSize
+        };
+        tile.intersect(surface->rect());
+        callback(tile);
+    }
+}
+
 class Paint : public Command {
     Property<std::shared_ptr<Selection>> selection{this, "selection"};
     Property<Color> color{this, "color", Tool::color.toString()};
@@ -23,35 +84,97 @@ class Paint : public Command {
     Property<bool> cursor{this, "cursor", false};
     Property<String> mode{this, "mode", "normal"};
     Property<std::shared_ptr<Surface>> surface{this, "surface"};
-    Vector<U32> undoData;
+    // XOR of each tile that changed, before and after painting
+    struct TileUndo {
+        Rect rect;
+        PixelDelta delta;
+    };
+    Vector<TileUndo> undoTiles;
+
+    // Packs the pixels of rect into out
+    static void readTile(const U32* pixels, U32 stride, const Rect& rect, Vector<U32>& out) {
+        out.resize(rect.width * rect.height);
+        for (U32 y = 0; y < rect.height; ++y) {
+            auto in = pixels + (rect.y + y) * stride + rect.x;
+            std::copy(in, in + rect.width, out.data() + y * rect.width);
+        }
+    }
+
+    // Compares the backed up tiles to the surface, keeping the ones that changed
+    void captureUndo(Surface* surface) {
+        undoTiles.clear();
+        auto surfaceData = surface->data();
+        auto backupData = backup->data();
+        U32 stride = surface->width();
+        Vector<U32> before, after;
+        eachBackupTile(surface, [&](const Rect& tile) {
+            readTile(backupData, stride, tile, before);
+            readTile(surfaceData, stride, tile, after);
+            if (before != after)
+                undoTiles.push_back({tile, PixelDelta{before.data(), after.data(), U32(before.size())}});
+        });
+    }
 
 public:
+    U64 memoryUsage() override {
+        U64 total = 0;
+        for (auto& tile : undoTiles)
+            total += tile.delta.memoryUsage();
+        return total;
+    }
+
+    void spill(const std::shared_ptr<Journal>& journal) override {
+        for (auto& tile : undoTiles)
+            tile.delta.spill(journal);
+    }
+
+    bool prepareUndo() override {
+        for (auto& tile : undoTiles) {
+            if (!tile.delta.load())
+                return false;
+        }
+        return true;
+    }
+
     void undo() override {
         restoreBackupSurface();
-        auto selection = *this->selection;
-        if (!selection) {
-            logI("No selection");
+        auto surface = this->surface->get();
+        if (!surface)
             return;
+        auto surfaceData = surface->data();
+        U32 stride = surface->width();
+        Vector<U32> pixels;
+        Rect dirty;
+        for (auto& tile : undoTiles) {
+            readTile(surfaceData, stride, tile.rect, pixels);
+            if (!tile.delta.apply(pixels.data(), pixels.size()))
+                continue;
+            for (U32 y = 0; y < tile.rect.height; ++y) {
+                auto in = pixels.data() + y * tile.rect.width;
+                std::copy(in, in + tile.rect.width, surfaceData + (tile.rect.y + y) * stride + tile.rect.x);
+            }
+            dirty.expand(tile.rect.x, tile.rect.y);
+            dirty.expand(tile.rect.right() - 1, tile.rect.bottom() - 1);
         }
-        selection->write(surface->get(), undoData);
+        if (!dirty.empty())
+            surface->setDirty(dirty);
     }
 
     void setupPreview() {
         auto surface = this->surface->get();
-        if (!backup) {
-            backup = std::make_shared<Surface>();
+        if (!backupSelection)
             backupSelection = inject<Selection>{"new"};
-        }
 
-        backup->resize(surface->width(), surface->height());
         auto surfaceData = surface->data();
         if (surfaceData == backupSurface) {
             if (!cursor) {
                 backupSelection->blend(*selection->get());
+                backupRegion(surface, (*selection)->getBounds());
             } else {
                 backupSelection->write(surface, cursorUndo);
                 backupSelection->clear();
                 backupSelection->add(*selection->get());
+                backupRegion(surface, (*selection)->getBounds());
                 cursorUndo = (*selection)->read(backup.get());
             }
             return;
@@ -63,23 +186,30 @@ public:
         backupSelection->clear();
         backupSelection->add(*selection->get());
         backupSurface = surfaceData;
-        auto backupData = backup->data();
-        for (std::size_t i = 0, size = surface->width() * surface->height(); i < size; ++i) {
-            backupData[i] = surfaceData[i];
-        }
+        startBackup(surface);
+        backupRegion(surface, (*selection)->getBounds());
     }
 
     void restoreBackupSurface() {
-        if (!backup)
+        if (backupRect.empty())
             return;
         auto surface = this->surface->get();
+        U32 width = surface->width();
         auto backupData = backup->data();
         auto surfaceData = surface->data();
-        for (std::size_t i = 0, size = surface->width() * surface->height(); i < size; ++i) {
-            surfaceData[i] = backupData[i];
-        }
-        surface->setDirty(surface->rect());
-        backup.reset();
+        eachBackupTile(surface, [&](const Rect& tile) {
+            for (S32 y = tile.y; y < tile.bottom(); ++y) {
+                auto offset = y * width + tile.x;
+                std::copy(backupData + offset, backupData + offset + tile.width, surfaceData + offset);
+            }
+        });
+        surface->setDirty(backupRect);
+        discardBackup();
+    }
+
+    void discardBackup() {
+        std::fill(backupTiles.begin(), backupTiles.end(), false);
+        backupRect = Rect{};
         backupSurface = nullptr;
     }
 
@@ -87,6 +217,15 @@ public:
         if (!*surface)
             return;
 
+        // A filter is still writing to the document's cells. Neither a
+        // cursor nor a stroke may touch them, and a stroke that was already
+        // underway takes its preview pixels back off.
+        if (auto doc = this->doc(); doc && doc->isLocked()) {
+            if (backupSurface && backupSurface == (*surface)->data())
+                restoreBackupSurface();
+            return;
+        }
+
         auto selection = this->selection->get();
         if (!selection) {
             this->selection.value = inject<Selection>{"new"};
@@ -115,13 +254,14 @@ public:
         if (!preview) {
             if (backupSurface == readData) {
                 backupSelection->blend(*selection);
+                backupRegion(surface, selection->getBounds());
                 readData = backup->data();
                 selection = backupSelection.get();
                 std::swap(*this->selection, backupSelection);
                 backupSelection->clear();
-                undoData = selection->read(backup.get());
-            } else {
-                undoData = selection->read(surface);
+            } else if (!cursor) {
+                startBackup(surface);
+                backupRegion(surface, selection->getBounds());
             }
             backupSurface = nullptr;
             if (cursor) {
@@ -137,40 +277,36 @@ public:
 
         auto maskRect = selection->getBounds();
 
-        if (maskRect.empty())
+        if (maskRect.empty()) {
+            if (!preview)
+                discardBackup();
             return;
+        }
 
-        auto& mask = selection->getData();
         auto commonRect = maskRect;
-        auto maskStride = maskRect.width;
         auto surfaceStride = surface->width();
 
-        commonRect.intersect({0, 0, surface->width(), surface->height()});
-
-        U32 maskOffsetY = maskRect.y > 0 ? 0 : -maskRect.y;
-        U32 maskOffsetX = maskRect.x > 0 ? 0 : -maskRect.x;
-        U32 surfaceOffsetY = commonRect.y > 0 ? commonRect.y : 0;
-        U32 surfaceOffsetX = commonRect.x > 0 ? commonRect.x : 0;
+        commonRect.intersect(surface->rect());
 
         inject<Blender> blender{*mode};
         if (blender) {
-            Color low;
-            for (U32 y = 0; y < commonRect.height; ++y) {
-                U32 maskIndex = (y + maskOffsetY) * maskStride + maskOffsetX;
-                U32 surfaceIndex = (y + surfaceOffsetY) * surfaceStride + surfaceOffsetX;
-                for (U32 x = 0; x < commonRect.width; ++x, ++maskIndex, ++surfaceIndex) {
-                    auto amount = mask[maskIndex] * (1.0f / 255.0f);
-                    low.fromU32(readData[surfaceIndex]);
-                    writeData[surfaceIndex] = blender->blendPixel(low, color, amount);
-                }
-            }
+            U32 high = color.toU32();
+            Vector<U8> mask;
+            selection->eachSpan(commonRect, [&](S32 y, S32 x0, S32 x1, U8 amount) {
+                U32 length = x1 - x0;
+                mask.assign(length, amount);
+                U32 surfaceIndex = y * surfaceStride + x0;
+                blender->blendMask(writeData + surfaceIndex, readData + surfaceIndex, high, mask.data(), length);
+            });
         }
 
         surface->setDirty(commonRect);
         if (preview)
             this->selection->get()->clear();
         else {
-            backup.reset();
+            if (!cursor)
+                captureUndo(surface);
+            discardBackup();
             if (!cursor)
                 commit();
         }
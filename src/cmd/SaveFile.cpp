@@ -32,7 +32,8 @@ public:
             dialog->filters = std::move(filters);
             dialog->save([=](const Vector<String>& name){
                 that->set("filename", name.empty() ? "" : name[0]);
-                if (!fileName->empty()) {
+                // the dialog may close after a filter started
+                if (!fileName->empty() && !that->isBusy()) {
                     if (!*exportAs)
                         doc()->setPath(fileName);
                     FileSystem::write(fileName, doc());
@@ -42,7 +43,7 @@ public:
     }
 
     void run() override {
-        if (!doc())
+        if (!doc() || isBusy())
             return;
         if (*saveAs || !doc()->hasPath()) {
             showSaveDialog();
@@ -14,8 +14,10 @@ class SelectAll : public Command {
 
 public:
     void run() override {
+        if (isBusy())
+            return;
         if (auto cell = this->cell()) {
-            inject<Selection> selection{"new"};
+            inject<Selection> selection{"rle"};
             selection->add({0, 0, doc()->width(), doc()->height()}, 255);
             cell->setSelection(selection);
         }
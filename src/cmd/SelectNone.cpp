@@ -14,6 +14,8 @@ class SelectNone : public Command {
 
 public:
     void run() override {
+        if (isBusy())
+            return;
         if (auto cell = this->cell()) {
             cell->setSelection(nullptr);
         }
@@ -30,7 +30,7 @@ public:
 
     void run() override {
         auto doc = this->doc();
-        if (!doc)
+        if (!doc || isBusy())
             return;
         if (!*targetCell)
             *targetCell = cell();
@@ -31,6 +31,7 @@ void Font::Glyph::blitTo(S32 offsetX, S32 offsetY, const Color& color, Surface&
             }
         }
     } else {
+        Surface::WriteScope writes{target};
         for (U32 y = 0; y < height; ++y) {
             for (U32 x = 0; x < width; ++x) {
                 if (data[y * width + x] < threshold)
@@ -0,0 +1,116 @@
+// Copyright (c) 2021 LibreSprite Authors (cf. AUTHORS.md)
+// This file is released under the terms of the MIT license.
+// Read LICENSE.txt for more information.
+
+#include <algorithm>
+#include <cstdio>
+
+#include <common/Journal.hpp>
+#include <fs/FileSystem.hpp>
+#include <log/Log.hpp>
+
+Journal::~Journal() {
+    if (!file)
+        return;
+    auto uid = file->getUID();
+    file->close();
+    file.reset();
+    std::remove(uid.c_str());
+}
+
+std::shared_ptr<const Journal::Entry> Journal::write(const Vector<U8>& data) {
+    if (failed)
+        return nullptr;
+
+    if (!file) {
+        if (auto entity = inject<FileSystem>{}->find(path))
+            file = entity->get<fs::File>();
+        if (!file || !file->open({.write=true, .create=true, .truncate=true})) {
+            logE("Could not open journal ", path);
+            file.reset();
+            failed = true;
+            return nullptr;
+        }
+    }
+
+    // first fit, so the file only grows when no hole is big enough
+    U64 offset = end;
+    auto hole = std::find_if(free.begin(), free.end(), [&](const Entry& hole) {
+        return hole.size >= data.size();
+    });
+    if (hole != free.end())
+        offset = hole->offset;
+
+    if (!file->seek(offset) || file->write(data.data(), data.size()) != data.size()) {
+        // Don't retry for every other entry, the disk is likely full
+        logE("Could not write to journal ", path);
+        failed = true;
+        return nullptr;
+    }
+
+    if (hole != free.end()) {
+        hole->offset += data.size();
+        hole->size -= data.size();
+        if (!hole->size)
+            free.erase(hole);
+    } else {
+        end += data.size();
+    }
+
+    live++;
+    std::weak_ptr<Journal> weak = weak_from_this();
+    return std::shared_ptr<const Entry>(new Entry{offset, data.size()}, [weak](const Entry* entry) {
+        if (auto journal = weak.lock())
+            journal->release(*entry);
+        delete entry;
+    });
+}
+
+void Journal::release(const Entry& entry) {
+    if (!--live) {
+        // Nothing is referenced anymore, the next write starts a new file.
+        auto uid = file->getUID();
+        file->close();
+        file.reset();
+        std::remove(uid.c_str());
+        free.clear();
+        end = 0;
+        return;
+    }
+
+    if (!entry.size)
+        return;
+
+    auto next = std::lower_bound(free.begin(), free.end(), entry.offset, [](const Entry& hole, U64 offset) {
+        return hole.offset < offset;
+    });
+    Entry merged = entry;
+    if (next != free.end() && merged.offset + merged.size == next->offset) {
+        merged.size += next->size;
+        next = free.erase(next);
+    }
+    if (next != free.begin()) {
+        auto prev = next - 1;
+        if (prev->offset + prev->size == merged.offset) {
+            merged.offset = prev->offset;
+            merged.size += prev->size;
+            next = free.erase(prev);
+        }
+    }
+
+    if (merged.offset + merged.size == end) {
+        end = merged.offset;
+    } else {
+        free.insert(next, merged);
+    }
+}
+
+bool Journal::read(const Entry& entry, Vector<U8>& data) {
+    data.resize(entry.size);
+    if (!file || !file->seek(entry.offset) || file->read(data.data(), entry.size) != entry.size) {
+        logE("Could not read from journal ", path);
+        data.clear();
+        return false;
+    }
+    return true;
+}
@@ -0,0 +1,42 @@
+// Copyright (c) 2021 LibreSprite Authors (cf. AUTHORS.md)
+// This file is released under the terms of the MIT license.
+// Read LICENSE.txt for more information.
+
+#pragma once
+
+#include <common/types.hpp>
+
+namespace fs {
+    class File;
+}
+
+// Scratch file for data that is rarely read back, such as old undo
+// history. The file is created on the first write and deleted along with
+// the journal. Space is given back when the last handle to an entry goes
+// away and reused by later writes, the file is truncated once nothing in
+// it is referenced anymore.
+class Journal : public std::enable_shared_from_this<Journal> {
+public:
+    struct Entry {
+        U64 offset = 0;
+        U64 size = 0;
+    };
+
+    Journal(const String& path) : path{path} {}
+    ~Journal();
+
+    // Returns nullptr if the file could not be written
+    std::shared_ptr<const Entry> write(const Vector<U8>& data);
+    bool read(const Entry& entry, Vector<U8>& data);
+
+private:
+    String path;
+    std::shared_ptr<fs::File> file;
+    U64 end = 0;
+    U32 live = 0;
+    bool failed = false;
+    // Unused ranges below end, sorted by offset and never adjacent
+    Vector<Entry> free;
+
+    void release(const Entry& entry);
+};
@@ -0,0 +1,114 @@
+// Copyright (c) 2021 LibreSprite Authors (cf. AUTHORS.md)
+// This file is released under the terms of the MIT license.
+// Read LICENSE.txt for more information.
+
+#include <algorithm>
+#include <cstring>
+
+#include <common/PixelDelta.hpp>
+
+// Each packet starts with a varint header. An even header h is a run of
+// h / 2 + 1 copies of the value that follows, an odd one is followed by
+// h / 2 + 1 literal values.
+
+static void writeVarint(Vector<U8>& out, U32 value) {
+    while (value >= 0x80) {
+        out.push_back(value | 0x80);
+        value >>= 7;
+    }
+    out.push_back(value);
+}
+
+static U32 readVarint(const U8*& in) {
+    U32 value = 0;
+    for (U32 shift = 0;; shift += 7) {
+        U8 byte = *in++;
+        value |= U32(byte & 0x7F) << shift;
+        if (!(byte & 0x80))
+            return value;
+    }
+}
+
+static void writeValue(Vector<U8>& out, U32 value) {
+    auto offset = out.size();
+    out.resize(offset + sizeof(value));
+    std::memcpy(out.data() + offset, &value, sizeof(value));
+}
+
+PixelDelta::PixelDelta(const U32* before, const U32* after, U32 count) : count{count} {
+    U32 literalStart = 0;
+    auto flushLiterals = [&](U32 end) {
+        if (literalStart == end)
+            return;
+        writeVarint(data, (end - literalStart - 1) << 1 | 1);
+        for (U32 i = literalStart; i < end; ++i)
+            writeValue(data, before[i] ^ after[i]);
+    };
+
+    for (U32 i = 0; i < count;) {
+        U32 value = before[i] ^ after[i];
+        U32 end = i + 1;
+        while (end < count && (before[end] ^ after[end]) == value)
+            ++end;
+        if (end - i >= 3) {
+            flushLiterals(i);
+            writeVarint(data, (end - i - 1) << 1);
+            writeValue(data, value);
+            literalStart = end;
+        }
+        i = end;
+    }
+    flushLiterals(count);
+    data.shrink_to_fit();
+}
+
+bool PixelDelta::spill(const std::shared_ptr<Journal>& journal) {
+    if (this->journal || data.empty())
+        return false;
+    entry = journal->write(data);
+    if (!entry)
+        return false;
+    this->journal = journal;
+    data = Vector<U8>{};
+    return true;
+}
+
+bool PixelDelta::load() {
+    if (!journal)
+        return true;
+    Vector<U8> paged;
+    if (!journal->read(*entry, paged))
+        return false;
+    data = std::move(paged);
+    entry.reset();
+    journal.reset();
+    return true;
+}
+
+bool PixelDelta::apply(U32* pixels, U32 count) const {
+    Vector<U8> paged;
+    if (journal && !journal->read(*entry, paged))
+        return false;
+    auto& data = journal ? paged : this->data;
+    count = std::min(count, this->count);
+    auto in = data.data();
+    auto end = in + data.size();
+    U32 value;
+    for (U32 i = 0; in < end && i < count;) {
+        U32 header = readVarint(in);
+        U32 length = std::min((header >> 1) + 1, count - i);
+        if (header & 1) {
+            for (U32 j = 0; j < length; ++j, in += sizeof(value)) {
+                std::memcpy(&value, in, sizeof(value));
+                pixels[i++] ^= value;
+            }
+            in += ((header >> 1) + 1 - length) * sizeof(value);
+        } else {
+            std::memcpy(&value, in, sizeof(value));
+            in += sizeof(value);
+            for (U32 j = 0; j < length; ++j)
+                pixels[i++] ^= value;
+        }
+    }
+    return true;
+}
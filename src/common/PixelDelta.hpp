@@ -0,0 +1,35 @@
+// Copyright (c) 2021 LibreSprite Authors (cf. AUTHORS.md)
+// This file is released under the terms of the MIT license.
+// Read LICENSE.txt for more information.
+
+#pragma once
+
+#include <common/Journal.hpp>
+#include <common/types.hpp>
+
+// The XOR of two pixel buffers of the same size, run-length encoded.
+// Applying it to either buffer yields the other one, so undo data only
+// has to keep what changed instead of a copy of the old pixels.
+class PixelDelta {
+    Vector<U8> data;
+    U32 count = 0;
+    std::shared_ptr<Journal> journal;
+    std::shared_ptr<const Journal::Entry> entry;
+
+public:
+    PixelDelta() = default;
+    PixelDelta(const U32* before, const U32* after, U32 count);
+
+    // XORs the delta into the first count pixels. Returns false, leaving
+    // the pixels alone, if the spilled delta can't be read back.
+    bool apply(U32* pixels, U32 count) const;
+
+    // Moves the encoded pixels to journal. apply reads them back each time.
+    bool spill(const std::shared_ptr<Journal>& journal);
+
+    // Reads spilled pixels back into memory, so that apply can't fail
+    bool load();
+
+    U32 size() const {return count;}
+    U64 memoryUsage() const {return data.capacity();}
+};
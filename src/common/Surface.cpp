@@ -2,15 +2,124 @@
 // This file is released under the terms of the MIT license.
 // Read LICENSE.txt for more information.
 
+#include <algorithm>
+#include <cstring>
+
 #include <common/Surface.hpp>
 
+static const std::shared_ptr<const Surface::Tile> emptyTile = std::make_shared<Surface::Tile>();
+
 std::shared_ptr<Surface> Surface::clone() {
     auto other = std::make_shared<Surface>();
-    other->resize(_width, _height);
-    other->setPixels(getPixels());
+    other->_width = _width;
+    other->_height = _height;
+    if (isTiled()) {
+        other->tiles = tiles;
+        return other;
+    }
+
+    U32 count = tileColumns() * tileRows();
+    other->tiles.resize(count);
+    lastClone.resize(count);
+    for (U32 row = 0, i = 0; row < tileRows(); ++row) {
+        for (U32 column = 0; column < tileColumns(); ++column, ++i) {
+            auto tile = makeTile(column, row, lastClone[i].lock());
+            lastClone[i] = tile;
+            other->tiles[i] = std::move(tile);
+        }
+    }
     return other;
 }
 
+std::shared_ptr<const Surface::Tile> Surface::makeTile(U32 column, U32 row, std::shared_ptr<const Tile> previous) {
+    U32 x = column * tileSize;
+    U32 y = row * tileSize;
+    U32 width = std::min(tileSize, _width - x);
+    U32 height = std::min(tileSize, _height - y);
+    auto src = pixels.data() + y * _width + x;
+
+    PixelType color = *src;
+    bool solid = true;
+    for (U32 ty = 0; solid && ty < height; ++ty) {
+        auto line = src + ty * _width;
+        for (U32 tx = 0; tx < width; ++tx) {
+            if (line[tx] != color) {
+                solid = false;
+                break;
+            }
+        }
+    }
+
+    if (solid) {
+        if (!color)
+            return emptyTile;
+        if (previous && previous->solid() && previous->color == color)
+            return previous;
+        auto tile = std::make_shared<Tile>();
+        tile->color = color;
+        return tile;
+    }
+
+    if (previous && !previous->solid()) {
+        bool same = true;
+        for (U32 ty = 0; same && ty < height; ++ty) {
+            same = !memcmp(src + ty * _width, previous->pixels.data() + ty * width, width * sizeof(PixelType));
+        }
+        if (same)
+            return previous;
+    }
+
+    auto tile = std::make_shared<Tile>();
+    tile->pixels.resize(width * height);
+    for (U32 ty = 0; ty < height; ++ty) {
+        memcpy(tile->pixels.data() + ty * width, src + ty * _width, width * sizeof(PixelType));
+    }
+    return tile;
+}
+
+Surface::PixelType Surface::tilePixel(U32 x, U32 y) const {
+    auto& tile = *tiles[(y / tileSize) * tileColumns() + x / tileSize];
+    if (tile.solid())
+        return tile.color;
+    U32 width = std::min(tileSize, _width - x / tileSize * tileSize);
+    return tile.pixels[(y % tileSize) * width + x % tileSize];
+}
+
+void Surface::materialize() {
+    pixels.resize(_width * _height);
+    lastClone.resize(tiles.size());
+    for (U32 row = 0, i = 0; row < tileRows(); ++row) {
+        for (U32 column = 0; column < tileColumns(); ++column, ++i) {
+            U32 x = column * tileSize;
+            U32 y = row * tileSize;
+            U32 width = std::min(tileSize, _width - x);
+            U32 height = std::min(tileSize, _height - y);
+            auto& tile = *tiles[i];
+            auto dst = pixels.data() + y * _width + x;
+            for (U32 ty = 0; ty < height; ++ty, dst += _width) {
+                if (tile.solid()) {
+                    std::fill(dst, dst + width, tile.color);
+                } else {
+                    memcpy(dst, tile.pixels.data() + ty * width, width * sizeof(PixelType));
+                }
+            }
+            // the pixels match these tiles until someone writes to them
+            lastClone[i] = tiles[i];
+        }
+    }
+    tiles.clear();
+}
+
+Surface& Surface::operator = (const Surface& other) {
+    _width = other._width;
+    _height = other._height;
+    pixels = other.pixels;
+    tiles = other.tiles;
+    lastClone.clear();
+    setDirty(rect());
+    return *this;
+}
+
 TextureInfo& Surface::info() {
     if (!_textureInfo)
         _textureInfo = std::make_unique<TextureInfo>();
@@ -18,24 +127,39 @@ TextureInfo& Surface::info() {
 }
 
 void Surface::resize(U32 width, U32 height) {
+    if (width == _width && height == _height)
+        return;
+    if (isTiled())
+        materialize();
+    lastClone.clear();
     _width = width;
     _height = height;
     pixels.resize(width * height);
 }
 
 void Surface::setDirty(const Rect& region) {
+    if (writeScopes) {
+        if (!region.empty()) {
+            pendingDirty.expand(region.x, region.y);
+            pendingDirty.expand(region.right() - 1, region.bottom() - 1);
+        }
+        return;
+    }
     if (_textureInfo)
         _textureInfo->setDirty(region);
 }
 
 void Surface::setPixels(const Vector<PixelType>& read) {
-    if (read.size() != pixels.size())
+    if (read.size() != _width * _height)
         return;
     pixels = read;
+    tiles.clear();
     setDirty({0, 0, _width, _height});
 }
 
 void Surface::setHLine(S32 x, S32 y, S32 w, PixelType pixel) {
+    if (isTiled())
+        materialize();
     if (x < 0) {
         w += x;
         x = 0;
@@ -53,6 +177,8 @@ void Surface::setHLine(S32 x, S32 y, S32 w, PixelType pixel) {
 }
 
 void Surface::antsHLine(S32 x, S32 y, S32 w, U32 age, PixelType A, PixelType B) {
+    if (isTiled())
+        materialize();
     if (x < 0) {
         w += x;
         x = 0;
@@ -71,6 +197,8 @@ void Surface::antsHLine(S32 x, S32 y, S32 w, U32 age, PixelType A, PixelType B)
 }
 
 void Surface::setVLine(S32 x, S32 y, S32 h, PixelType pixel) {
+    if (isTiled())
+        materialize();
     if (y < 0) {
         h += y;
         y = 0;
@@ -89,6 +217,8 @@ void Surface::setVLine(S32 x, S32 y, S32 h, PixelType pixel) {
 }
 
 void Surface::antsVLine(S32 x, S32 y, S32 h, U32 age, PixelType A, PixelType B) {
+    if (isTiled())
+        materialize();
     if (y < 0) {
         h += y;
         y = 0;
@@ -130,6 +260,8 @@ void Surface::fillRect(const Rect& rect, PixelType pixel) {
     if (w <= 0 || U32(y) >= _height || h <= 0 || U32(x) >= _width) {
         return;
     }
+    if (isTiled())
+        materialize();
     U32 index = y * _width + x;
     for (; h; --h) {
         for (S32 e = 0; e < w; ++e) {
@@ -142,6 +274,8 @@ void Surface::fillRect(const Rect& rect, PixelType pixel) {
 void Surface::setPixel(U32 x, U32 y, PixelType pixel) {
     U32 index = x + y * _width;
     if (index < _width * _height) {
+        if (isTiled())
+            materialize();
         setDirty({S32(x), S32(y), 1, 1});
         pixels[index] = pixel;
     }
@@ -15,20 +15,82 @@
 class Surface : public std::enable_shared_from_this<Surface> {
 public:
     using PixelType = U32;
+    static constexpr U32 tileSize = 64;
+
+    // An immutable block of up to tileSize x tileSize pixels, shared between
+    // surfaces until one of them writes to it. Tiles on the right and bottom
+    // edges are clipped to the surface. Solid tiles have no pixel storage.
+    struct Tile {
+        PixelType color = 0;
+        Vector<PixelType> pixels;
+        bool solid() const {return pixels.empty();}
+    };
 
 private:
     U32 _width = 0, _height = 0;
     Vector<PixelType> pixels;
     std::unique_ptr<TextureInfo> _textureInfo;
 
+    // When non-empty the surface is tiled and `pixels` is empty.
+    Vector<std::shared_ptr<const Tile>> tiles;
+
+    // The tiles of the last clone, so that consecutive clones of a surface
+    // share the tiles that did not change in between.
+    Vector<std::weak_ptr<const Tile>> lastClone;
+
+    // While a WriteScope is open, setDirty collects regions here instead
+    // of notifying the textures.
+    U32 writeScopes = 0;
+    Rect pendingDirty;
+
+    U32 tileColumns() const {return (_width + tileSize - 1) / tileSize;}
+    U32 tileRows() const {return (_height + tileSize - 1) / tileSize;}
+    std::shared_ptr<const Tile> makeTile(U32 column, U32 row, std::shared_ptr<const Tile> previous);
+    PixelType tilePixel(U32 x, U32 y) const;
+    void materialize();
+
 public:
+    // Batches the setDirty calls made while it lives, the textures get the
+    // union of their regions once, when the outermost scope ends.
+    class WriteScope {
+        Surface& surface;
+    public:
+        WriteScope(Surface& surface) : surface{surface} {
+            surface.writeScopes++;
+        }
+
+        WriteScope(const WriteScope&) = delete;
+
+        ~WriteScope() {
+            if (--surface.writeScopes || surface.pendingDirty.empty())
+                return;
+            Rect dirty = surface.pendingDirty;
+            surface.pendingDirty.clear();
+            surface.setDirty(dirty);
+        }
+    };
+
     U32 width() const {return _width;}
     U32 height() const {return _height;}
     Rect rect() const {return {0, 0, _width, _height};}
-    PixelType* data() {return pixels.data();}
+    bool isTiled() const {return !tiles.empty();}
+
+    PixelType* data() {
+        if (isTiled())
+            materialize();
+        return pixels.data();
+    }
+
     U32 dataSize() {return _width * _height * sizeof(PixelType);};
-    const Vector<PixelType>& getPixels() {return pixels;}
 
+    const Vector<PixelType>& getPixels() {
+        if (isTiled())
+            materialize();
+        return pixels;
+    }
+
+    // Returns a tiled copy-on-write snapshot. Tiles that are unchanged since
+    // the previous clone are shared with it instead of being copied.
     std::shared_ptr<Surface> clone();
     TextureInfo& info();
     void resize(U32 width, U32 height);
@@ -37,14 +99,18 @@ public:
 
     Color getPixel(U32 x, U32 y) {
         U32 index = x + y * _width;
-        return (index >= _width * _height) ? Color{} : getColor(pixels[index]);
+        if (index >= _width * _height)
+            return Color{};
+        return getColor(isTiled() ? tilePixel(x, y) : pixels[index]);
     }
 
     PixelType getPixelUnsafe(U32 x, U32 y) {
-        return pixels[x + y * _width];
+        return isTiled() ? tilePixel(x, y) : pixels[x + y * _width];
     }
 
     void setPixelUnsafe(U32 x, U32 y, PixelType pixel) {
+        if (isTiled())
+            materialize();
         U32 index = x + y * _width;
         pixels[index] = pixel;
         setDirty({S32(x), S32(y), 1, 1});
@@ -65,11 +131,5 @@ public:
         return pixel;
     }
 
-    Surface& operator = (const Surface& other) {
-        _width = other._width;
-        _height = other._height;
-        pixels = other.pixels;
-        setDirty(rect());
-        return *this;
-    }
+    Surface& operator = (const Surface& other);
 };
@@ -25,7 +25,7 @@ public:
             this->selection.reset();
         } else {
             if (!this->selection) {
-                this->selection = inject<Selection>{"new"};
+                this->selection = inject<Selection>{"rle"};
             }
             *this->selection = *selection;
         }
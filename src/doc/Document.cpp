@@ -6,6 +6,7 @@
 
 #include <cmd/Command.hpp>
 #include <common/Config.hpp>
+#include <common/Journal.hpp>
 #include <common/Messages.hpp>
 #include <common/PubSub.hpp>
 #include <common/PropertySet.hpp>
@@ -19,6 +20,7 @@
 
 class DocumentImpl : public Document {
     friend class HistoryLock;
+    friend class EditLock;
     static inline U32 unsavedNumber = 0;
 
     PubSub<> pub{this};
@@ -34,6 +36,8 @@ class DocumentImpl : public Document {
     Vector<std::shared_ptr<Command>> history;
     U32 historyCursor = 0;
     U32 lockHistory = 0;
+    U32 lockEdits = 0;
+    std::shared_ptr<Journal> journal;
 
     Vector<Cell*> _cells;
 
@@ -213,16 +217,44 @@ public:
             history.resize(historyCursor);
         logV("Commit: ", command->getName());
         history.push_back(command);
-        U32 maxUndoSize = inject<Config>{}->properties->get<U32>("max-undo-size");
+        auto& properties = inject<Config>{}->properties;
+        U32 maxUndoSize = properties->get<U32>("max-undo-size");
         if (history.size() > maxUndoSize)
             history.erase(history.begin());
+
+        // max-undo-memory is in megabytes, 0 means there is no limit.
+        // The oldest entries go to the journal first and are only dropped
+        // if they can't be spilled.
+        U64 maxUndoMemory = U64{properties->get<U32>("max-undo-memory")} << 20;
+        if (maxUndoMemory) {
+            U64 total = 0;
+            for (auto& entry : history)
+                total += entry->memoryUsage();
+            for (U32 i = 0; total > maxUndoMemory && i + 1 < history.size(); ++i) {
+                U64 before = history[i]->memoryUsage();
+                if (!before)
+                    continue;
+                if (!journal)
+                    journal = std::make_shared<Journal>("%userdata/undo-" + GUID + ".journal");
+                history[i]->spill(journal);
+                total -= before - history[i]->memoryUsage();
+            }
+            U32 drop = 0;
+            while (total > maxUndoMemory && drop + 1 < history.size())
+                total -= history[drop++]->memoryUsage();
+            history.erase(history.begin(), history.begin() + drop);
+        }
         historyCursor = history.size();
         pub(msg::ModifyDocument{shared_from_this()});
     }
 
     void undo() override {
-        if (historyCursor == 0)
+        if (historyCursor == 0 || lockEdits)
+            return;
+        if (!history[historyCursor - 1]->prepareUndo()) {
+            logE("Could not read the undo data of ", history[historyCursor - 1]->getName());
             return;
+        }
         lockHistory++;
         historyCursor--;
         history[historyCursor]->undo();
@@ -231,7 +263,7 @@ public:
     }
 
     void redo() override {
-        if (historyCursor == history.size())
+        if (historyCursor == history.size() || lockEdits)
             return;
         lockHistory++;
         history[historyCursor]->redo();
@@ -244,6 +276,14 @@ public:
         return {shared_from_this()};
     }
 
+    EditLock getEditLock() override {
+        return {shared_from_this()};
+    }
+
+    bool isLocked() override {
+        return lockEdits;
+    }
+
     bool hasPath() override {
         return haspath;
     }
@@ -274,4 +314,13 @@ HistoryLock::~HistoryLock() {
     std::static_pointer_cast<DocumentImpl>(doc)->lockHistory--;
 }
 
+EditLock::EditLock(std::shared_ptr<Document> doc) : doc{doc} {
+    std::static_pointer_cast<DocumentImpl>(doc)->lockEdits++;
+}
+
+EditLock::~EditLock() {
+    if (doc)
+        std::static_pointer_cast<DocumentImpl>(doc)->lockEdits--;
+}
+
 static Document::Shared<DocumentImpl> reg{"new"};
@@ -21,6 +21,16 @@ public:
     ~HistoryLock();
 };
 
+// Held while a background job writes to the document's cells. Undo, redo
+// and edits are refused until the last one is released.
+class EditLock {
+    std::shared_ptr<Document> doc;
+public:
+    EditLock(std::shared_ptr<Document> doc);
+    EditLock(EditLock&& other) : doc{std::move(other.doc)} {}
+    ~EditLock();
+};
+
 class Document : public Injectable<Document>, public Serializable, public std::enable_shared_from_this<Document> {
 protected:
     friend class Cell;
@@ -43,6 +53,8 @@ public:
     virtual const Vector<Cell*> cells() const = 0;
 
     virtual HistoryLock getHistoryLock() = 0;
+    virtual EditLock getEditLock() = 0;
+    virtual bool isLocked() = 0;
     virtual void writeHistory(std::shared_ptr<Command> command) = 0;
     virtual std::shared_ptr<Command> getLastCommand() = 0;
     virtual void undo() = 0;
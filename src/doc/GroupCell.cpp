@@ -8,6 +8,7 @@
 #include <common/Surface.hpp>
 #include <doc/Cell.hpp>
 #include <doc/GroupCell.hpp>
+#include <task/TaskManager.hpp>
 
 class DirtyWatcher : public Texture {
 public:
@@ -36,6 +37,12 @@ public:
     Vector<std::shared_ptr<ChildCell>> data;
     HashMap<String, std::shared_ptr<Blender>> blenders;
     std::shared_ptr<Surface> previousResult;
+
+    // Composite of the layers below prefixLayer, so that edits on the
+    // active layer only need to re-blend the layers above it.
+    std::shared_ptr<Surface> prefix = std::make_shared<Surface>();
+    S32 prefixLayer = -1;
+    S32 lastActive = -1;
     static inline std::shared_ptr<Surface> tmp = std::make_shared<Surface>();
 
     String getType() const override {return "group";}
@@ -55,6 +62,7 @@ public:
     }
 
     void resize(U32 count) override {
+        prefixLayer = -1;
         if (count < data.size()) {
             for (std::size_t i = count, max = data.size(); i < max; ++i) {
                 if (data[i] && data[i]->cell)
@@ -108,13 +116,16 @@ public:
         }
 
         previousResult.reset();
+        prefixLayer = -1;
         pub(msg::ModifyGroup{});
     }
 
     void on(msg::ModifyCell& event) {
-        for (auto& child : data) {
-            if (child->cell == event.cell) {
+        for (S32 i = 0, max = data.size(); i < max; ++i) {
+            if (data[i] && data[i]->cell == event.cell) {
                 previousResult.reset();
+                if (i < prefixLayer)
+                    prefixLayer = -1;
                 break;
             }
         }
@@ -142,8 +153,10 @@ public:
             return composite.get();
 
         Rect dirty;
+        S32 active = layers; // lowest layer with changes
+        U32 present = 0;     // layers below active that get blended
 
-        for (auto i = 0; i < layers; ++i) {
+        for (S32 i = 0, max = layers; i < max; ++i) {
             if (!data[i])
                 continue;
             auto& cell = data[i]->cell;
@@ -164,6 +177,12 @@ public:
             }
 
             auto& region = dynamic_cast<DirtyWatcher*>(watcher.get())->dirtyRegion;
+            if (active == S32(layers)) {
+                if (!region.empty())
+                    active = i;
+                else
+                    present++;
+            }
             dirty.expand(region);
             dirty.intersect(composite->rect());
             region.clear();
@@ -173,42 +192,110 @@ public:
             return previousResult.get();
         }
 
-        bool dirtyResult = false;
-        result = composite;
+        struct Step {
+            Blender* blender;
+            const Surface::PixelType* low;
+            const Surface::PixelType* high;
+            Surface::PixelType* result;
+            U8 alpha;
+        };
+        Vector<Step> steps;
+
+        if (active < prefixLayer ||
+            prefix->width() != composite->width() ||
+            prefix->height() != composite->height())
+            prefixLayer = -1;
+
+        // Only build a new prefix once the same layer changes twice in a
+        // row, a single edit is cheaper to blend over its dirty rect.
+        bool buildPrefix = active < S32(layers) &&
+            active != prefixLayer &&
+            active == lastActive &&
+            present > 1;
+        lastActive = active;
+
+        S32 start = 0;
+        if (buildPrefix) {
+            // the cache has to be valid everywhere, not just where it's dirty
+            prefixLayer = -1;
+            dirty.clear();
+        } else if (prefixLayer != -1) {
+            start = prefixLayer;
+            low = prefix;
+            tmp->resize(composite->width(), composite->height());
+            if (dirty.empty())
+                dirty = composite->rect();
+        }
 
-        for (auto i = 0; i < layers; ++i) {
+        result = low ? low : composite;
+
+        for (S32 i = start, max = layers; i < max; ++i) {
             if (!data[i])
                 continue;
-            auto& watcher = data[i]->watcher;
             auto& cell = data[i]->cell;
+            if (!cell)
+                continue;
             auto composite = cell->getComposite();
+            if (!composite)
+                continue;
+            if (buildPrefix && i >= active) {
+                // redirect the last step below the active layer into the cache
+                steps.back().result = prefix->data();
+                result = low = prefix;
+                prefixLayer = active;
+                buildPrefix = false;
+            }
             if (!low) {
                 result->resize(composite->width(), composite->height());
                 tmp->resize(result->width(), result->height());
+                if (buildPrefix)
+                    prefix->resize(result->width(), result->height());
                 result = composite->shared_from_this();
                 if (dirty.empty())
                     dirty = result->rect();
             } else {
                 auto high = composite;
-                F32 alpha = cell->getAlpha();
                 result = low == tmp ? this->composite : tmp;
-                getBlender(cell->getBlendMode()).blend(result.get(), low.get(), high, alpha, dirty);
-                dirtyResult = true;
+                steps.push_back({
+                        &getBlender(cell->getBlendMode()),
+                        low->data(),
+                        high->data(),
+                        result->data(),
+                        Blender::toFixed(cell->getAlpha())
+                    });
             }
             low = result;
         }
 
-        if (result == tmp) {
-            for (S32 y = dirty.y; y < dirty.bottom(); ++y) {
-                for (S32 x = dirty.x; x < dirty.right(); ++x) {
-                    composite->setPixelUnsafe(x, y, result->getPixelUnsafe(x, y));
+        // Every tile runs the whole stack on its own pixels, so the output
+        // does not depend on how the tiles get scheduled.
+        bool copyBack = result == tmp;
+        if (!steps.empty()) {
+            U32 stride = composite->width();
+            auto src = tmp->data();
+            auto dst = composite->data();
+            auto blendTile = [&](const Rect& tile) {
+                for (auto& step : steps) {
+                    for (S32 y = tile.y; y < tile.bottom(); ++y) {
+                        U32 i = y * stride + tile.x;
+                        step.blender->blendRow(step.result + i, step.low + i, step.high + i, tile.width, step.alpha);
+                    }
                 }
+                if (copyBack) {
+                    for (S32 y = tile.y; y < tile.bottom(); ++y) {
+                        U32 i = y * stride + tile.x;
+                        std::copy(src + i, src + i + tile.width, dst + i);
+                    }
+                }
+            };
+            if (inject<TaskManager> taskman{InjectSilent::Yes}) {
+                taskman->parallelTiles(dirty, Surface::tileSize, blendTile);
+            } else {
+                blendTile(dirty);
             }
             result = composite;
-        }
-
-        if (dirtyResult)
             result->setDirty(dirty);
+        }
 
         previousResult = result;
         return result.get();
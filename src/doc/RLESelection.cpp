@@ -0,0 +1,425 @@
+// Copyright (c) 2021 LibreSprite Authors (cf. AUTHORS.md)
+// This file is released under the terms of the MIT license.
+// Read LICENSE.txt for more information.
+
+#include <algorithm>
+#include <deque>
+#include <limits>
+
+#include <doc/Selection.hpp>
+#include <log/Log.hpp>
+
+// Stores each row as a sorted list of runs of equal, non-zero coverage.
+// Rectangles and outlines cost memory and time in proportion to their
+// edges instead of their area. getData() builds a dense copy on demand.
+class RLESelection : public Selection {
+public:
+    // rows[0] is at bounds.y. A deque so that growing upwards, as happens
+    // when a selection is built pixel by pixel, doesn't shift every row.
+    std::deque<Row> rows;
+    Rect bounds;
+    mutable Vector<U8> data;
+    mutable bool dataIsValid = true;
+
+    // Combines two rows pixel by pixel, zero outside of their spans.
+    template<typename Op>
+    static void merge(const Row& a, const Row& b, Row& out, Op&& op) {
+        constexpr S32 none = std::numeric_limits<S32>::max();
+        out.clear();
+        U32 i = 0, j = 0;
+        S32 x = std::min(a.empty() ? none : a[0].x, b.empty() ? none : b[0].x);
+        while (i < a.size() || j < b.size()) {
+            S32 next = none;
+            U8 amountA = 0, amountB = 0;
+            if (i < a.size()) {
+                if (x >= a[i].x) {
+                    amountA = a[i].amount;
+                    next = a[i].end();
+                } else {
+                    next = a[i].x;
+                }
+            }
+            if (j < b.size()) {
+                if (x >= b[j].x) {
+                    amountB = b[j].amount;
+                    next = std::min(next, b[j].end());
+                } else {
+                    next = std::min(next, b[j].x);
+                }
+            }
+
+            U8 amount = op(amountA, amountB);
+            if (amount) {
+                if (!out.empty() && out.back().end() == x && out.back().amount == amount)
+                    out.back().length += next - x;
+                else
+                    out.push_back({x, U32(next - x), amount});
+            }
+
+            x = next;
+            if (i < a.size() && x >= a[i].end()) ++i;
+            if (j < b.size() && x >= b[j].end()) ++j;
+        }
+    }
+
+    // Combines span into row in place. Only the spans that overlap or touch
+    // it are merged, the rest of the row is left where it is.
+    template<typename Op>
+    static void combineSpan(Row& row, const Span& span, Op&& op) {
+        auto begin = std::lower_bound(row.begin(), row.end(), span.x, [](const Span& s, S32 x) {
+            return s.end() < x;
+        });
+        auto end = std::upper_bound(begin, row.end(), span.end(), [](S32 x, const Span& s) {
+            return x < s.x;
+        });
+        Row touched(begin, end), result;
+        merge(touched, Row{span}, result, op);
+        auto at = row.erase(begin, end);
+        row.insert(at, result.begin(), result.end());
+    }
+
+    static void encode(const U8* amounts, S32 x, U32 width, Row& out) {
+        out.clear();
+        for (U32 i = 0; i < width;) {
+            U8 amount = amounts[i];
+            U32 start = i;
+            while (++i < width && amounts[i] == amount);
+            if (amount)
+                out.push_back({S32(x + start), i - start, amount});
+        }
+    }
+
+    static U8 saturatedAdd(U8 a, U8 b) {
+        U32 acc = U32{a} + b;
+        return acc > 0xFF ? 0xFF : acc;
+    }
+
+    static U8 saturatedSubtract(U8 a, U8 b) {
+        S32 acc = S32{a} - b;
+        return acc < 0 ? 0 : acc;
+    }
+
+    static U8 blendOver(U8 a, U8 b) {
+        if (!b)
+            return a;
+        return U8(a + b * (255 - a) / 255.0f);
+    }
+
+    static U8 multiply(U8 a, U8 b) {
+        return U32{a} * b / 255;
+    }
+
+    // Returns the row at y, adding empty rows to reach it
+    Row& row(S32 y) {
+        if (rows.empty()) {
+            bounds.y = y;
+            rows.resize(1);
+        } else if (y < bounds.y) {
+            rows.insert(rows.begin(), bounds.y - y, Row{});
+            bounds.y = y;
+        } else if (y - bounds.y >= S32(rows.size())) {
+            rows.resize(y - bounds.y + 1);
+        }
+        return rows[y - bounds.y];
+    }
+
+    const Row* findRow(S32 y) const {
+        if (y < bounds.y || y - bounds.y >= S32(rows.size()))
+            return nullptr;
+        return &rows[y - bounds.y];
+    }
+
+    // Combines rows top to top + height with the rows other returns.
+    // Only for ops that leave a row alone when the other one is empty.
+    template<typename Other, typename Op>
+    void combine(S32 top, U32 height, Other&& other, Op&& op) {
+        Row empty, result;
+        for (S32 y = top; y < S32(top + height); ++y) {
+            auto otherRow = other(y);
+            if (!otherRow || otherRow->empty())
+                continue;
+            auto ownRow = findRow(y);
+            merge(ownRow ? *ownRow : empty, *otherRow, result, op);
+            if (result.empty() && !ownRow)
+                continue;
+            std::swap(row(y), result);
+        }
+        trim();
+    }
+
+    template<typename Op>
+    void combine(const Selection& other, Op&& op) {
+        if (auto rle = dynamic_cast<const RLESelection*>(&other)) {
+            combine(rle->bounds.y, rle->rows.size(), [&](S32 y){return rle->findRow(y);}, op);
+            return;
+        }
+        auto& otherBounds = other.getBounds();
+        auto& otherData = other.getData();
+        Row encoded;
+        combine(otherBounds.y, otherBounds.height, [&](S32 y) {
+            encode(&otherData[(y - otherBounds.y) * otherBounds.width], otherBounds.x, otherBounds.width, encoded);
+            return &encoded;
+        }, op);
+    }
+
+    // Adds amount to every pixel in rect. Every one of them ends up
+    // selected, so the bounds just grow to include rect.
+    void addRect(const Rect& rect, U8 amount) {
+        if (rect.empty())
+            return;
+        bool wasEmpty = rows.empty();
+        Span span{rect.x, rect.width, amount};
+        for (S32 y = rect.y; y < rect.bottom(); ++y)
+            combineSpan(row(y), span, saturatedAdd);
+        if (wasEmpty) {
+            bounds.x = rect.x;
+            bounds.width = rect.width;
+        } else {
+            S32 right = std::max(bounds.right(), rect.right());
+            bounds.x = std::min(bounds.x, rect.x);
+            bounds.width = right - bounds.x;
+        }
+        bounds.height = rows.size();
+        dataIsValid = false;
+        invalidateOutline();
+    }
+
+    // Takes amount off every pixel in rect. Only rows in rect change, so
+    // only they can empty out, and the horizontal bounds only need a
+    // rescan when rect reaches the left or right edge.
+    void subtractRect(Rect rect, U8 amount) {
+        rect.intersect(bounds);
+        if (rect.empty())
+            return;
+        Span span{rect.x, rect.width, amount};
+        for (S32 y = rect.y; y < rect.bottom(); ++y)
+            combineSpan(rows[y - bounds.y], span, saturatedSubtract);
+        dataIsValid = false;
+        invalidateOutline();
+        if (trimY() && (rect.x == bounds.x || rect.right() == bounds.right()))
+            trimX();
+    }
+
+    // Drops empty rows at either end and recomputes the horizontal bounds
+    void trim() {
+        dataIsValid = false;
+        invalidateOutline();
+        if (trimY())
+            trimX();
+    }
+
+    // Drops empty rows at either end, returns false if none are left.
+    bool trimY() {
+        U32 first = 0;
+        while (first < rows.size() && rows[first].empty())
+            first++;
+        U32 last = rows.size();
+        while (last > first && rows[last - 1].empty())
+            last--;
+        if (first == last) {
+            clear();
+            return false;
+        }
+        rows.erase(rows.begin() + last, rows.end());
+        rows.erase(rows.begin(), rows.begin() + first);
+        bounds.y += first;
+        bounds.height = rows.size();
+        return true;
+    }
+
+    // Recomputes the horizontal bounds from the first and last span of
+    // every row
+    void trimX() {
+        S32 minX = std::numeric_limits<S32>::max();
+        S32 maxX = std::numeric_limits<S32>::min();
+        for (auto& row : rows) {
+            if (row.empty())
+                continue;
+            minX = std::min(minX, row.front().x);
+            maxX = std::max(maxX, row.back().end());
+        }
+        bounds.x = minX;
+        bounds.width = maxX - minX;
+    }
+
+    const Rect& getBounds() const override {return bounds;}
+
+    Rect getTrimmedBounds() const override {return bounds;}
+
+    const Vector<U8>& getData() const override {
+        if (!dataIsValid) {
+            dataIsValid = true;
+            data.clear();
+            data.resize(bounds.width * bounds.height);
+            for (U32 y = 0; y < rows.size(); ++y) {
+                auto out = data.data() + y * bounds.width;
+                for (auto& span : rows[y])
+                    std::fill(out + (span.x - bounds.x), out + (span.end() - bounds.x), span.amount);
+            }
+        }
+        return data;
+    }
+
+    Selection& operator = (const Selection& other) override {
+        if (auto rle = dynamic_cast<const RLESelection*>(&other)) {
+            rows = rle->rows;
+            bounds = rle->bounds;
+            dataIsValid = false;
+            invalidateOutline();
+            return *this;
+        }
+        clear();
+        auto& otherBounds = other.getBounds();
+        add(otherBounds, other.getData().data(), otherBounds.width);
+        return *this;
+    }
+
+    void move(S32 offsetX, S32 offsetY) override {
+        bounds.x += offsetX;
+        bounds.y += offsetY;
+        for (auto& row : rows) {
+            for (auto& span : row)
+                span.x += offsetX;
+        }
+        dataIsValid = false;
+        invalidateOutline();
+    }
+
+    void add(const Selection& other) override {
+        combine(other, saturatedAdd);
+    }
+
+    void blend(const Selection& other) override {
+        combine(other, blendOver);
+    }
+
+    void mask(const Selection& other) override {
+        // rows that other doesn't cover at all end up empty
+        std::deque<Row> own;
+        std::swap(own, rows);
+        auto ownBounds = bounds;
+        bounds = Rect{};
+        auto ownRow = [&](S32 y) -> const Row* {
+            if (y < ownBounds.y || y - ownBounds.y >= S32(own.size()))
+                return nullptr;
+            return &own[y - ownBounds.y];
+        };
+        auto maskRow = [&](S32 y, const Row& otherRow) {
+            auto mine = ownRow(y);
+            if (!mine)
+                return;
+            Row result;
+            merge(*mine, otherRow, result, multiply);
+            if (!result.empty())
+                std::swap(row(y), result);
+        };
+        if (auto rle = dynamic_cast<const RLESelection*>(&other)) {
+            for (S32 y = ownBounds.y; y < ownBounds.bottom(); ++y) {
+                if (auto otherRow = rle->findRow(y))
+                    maskRow(y, *otherRow);
+            }
+        } else {
+            auto& otherBounds = other.getBounds();
+            auto& otherData = other.getData();
+            Row encoded;
+            S32 top = std::max(ownBounds.y, otherBounds.y);
+            S32 bottom = std::min(ownBounds.bottom(), otherBounds.bottom());
+            for (S32 y = top; y < bottom; ++y) {
+                encode(&otherData[(y - otherBounds.y) * otherBounds.width], otherBounds.x, otherBounds.width, encoded);
+                maskRow(y, encoded);
+            }
+        }
+        trim();
+    }
+
+    void add(S32 x, S32 y, U32 amount) override {
+        if (amount == 0)
+            return;
+        addRect(Rect{x, y, 1, 1}, std::min<U32>(amount, 0xFF));
+    }
+
+    void add(const Rect& rect, U32 amount) override {
+        if (amount == 0)
+            return;
+        addRect(rect, std::min<U32>(amount, 0xFF));
+    }
+
+    void add(const Rect& rect, const U8* amounts, U32 stride) override {
+        if (rect.empty())
+            return;
+        Row encoded;
+        combine(rect.y, rect.height, [&](S32 y) {
+            encode(amounts + (y - rect.y) * stride, rect.x, rect.width, encoded);
+            return &encoded;
+        }, saturatedAdd);
+    }
+
+    void subtract(S32 x, S32 y, U32 amount) override {
+        if (amount == 0)
+            return;
+        subtractRect(Rect{x, y, 1, 1}, std::min<U32>(amount, 0xFF));
+    }
+
+    void subtract(const Rect& rect, U32 amount) override {
+        if (amount == 0)
+            return;
+        subtractRect(rect, std::min<U32>(amount, 0xFF));
+    }
+
+    U8 get(S32 x, S32 y) override {
+        auto row = findRow(y);
+        if (!row)
+            return 0;
+        auto it = std::upper_bound(row->begin(), row->end(), x, [](S32 x, const Span& span) {
+            return x < span.x;
+        });
+        if (it == row->begin())
+            return 0;
+        --it;
+        return x < it->end() ? it->amount : 0;
+    }
+
+    void apply(const Rect& limit, const std::function<void(S32, S32, U8)>& callback) override {
+        S32 minY = std::max<S32>(bounds.y, limit.y);
+        S32 maxY = std::min<S32>(bounds.bottom(), limit.bottom());
+        S32 minX = std::max<S32>(bounds.x, limit.x);
+        S32 maxX = std::min<S32>(bounds.right(), limit.right());
+        for (S32 y = minY; y < maxY; ++y) {
+            S32 x = minX;
+            for (auto& span : rows[y - bounds.y]) {
+                S32 end = std::min(span.end(), maxX);
+                for (; x < span.x && x < maxX; ++x)
+                    callback(x, y, 0);
+                for (; x < end; ++x)
+                    callback(x, y, span.amount);
+            }
+            for (; x < maxX; ++x)
+                callback(x, y, 0);
+            callback(maxX, y, 0);
+        }
+        for (S32 x = minX; x <= maxX; ++x) {
+            callback(x, maxY, 0);
+        }
+    }
+
+    bool empty() const override {
+        return rows.empty();
+    }
+
+    const Row& getRow(S32 y, Row& scratch) const override {
+        if (auto row = findRow(y))
+            return *row;
+        scratch.clear();
+        return scratch;
+    }
+
+    void clear() override {
+        rows.clear();
+        bounds = Rect{};
+        data.clear();
+        dataIsValid = true;
+        invalidateOutline();
+    }
+};
+
+static Selection::Shared<RLESelection> reg{"rle"};
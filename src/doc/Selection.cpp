@@ -2,105 +2,261 @@
 // This file is released under the terms of the MIT license.
 // Read LICENSE.txt for more information.
 
+#include <limits>
+
 #include <doc/Selection.hpp>
 #include <log/Log.hpp>
 
-static Vector<U8> swap;
+void Selection::solidEdges(const Row& row, S32 left, S32 right, Vector<S32>& out) {
+    out.clear();
+    for (auto& span : row) {
+        if (span.amount <= 127)
+            continue;
+        S32 x0 = std::max(span.x, left);
+        S32 x1 = std::min(span.end(), right);
+        if (x0 >= x1)
+            continue;
+        if (!out.empty() && out.back() == x0)
+            out.back() = x1;
+        else {
+            out.push_back(x0);
+            out.push_back(x1);
+        }
+    }
+}
+
+const Selection::Outline& Selection::getOutline() const {
+    if (outline)
+        return *outline;
+    outline.emplace();
+    auto& horizontal = outline->horizontal;
+    auto& vertical = outline->vertical;
+
+    // vertical edges on consecutive rows are joined into one
+    Vector<U32> open, next;
+    U32 cursor = 0;
+    S32 row = std::numeric_limits<S32>::min();
+    traceOutline(
+        getBounds(),
+        [&](S32 x0, S32 x1, S32 y) {
+            horizontal.push_back({x0, y, U32(x1 - x0)});
+        },
+        [&](S32 x, S32 y) {
+            if (y != row) {
+                std::swap(open, next);
+                next.clear();
+                cursor = 0;
+                row = y;
+            }
+            while (cursor < open.size() && vertical[open[cursor]].x < x)
+                cursor++;
+            if (cursor < open.size()) {
+                auto& edge = vertical[open[cursor]];
+                if (edge.x == x && edge.y + S32(edge.length) == y) {
+                    edge.length++;
+                    next.push_back(open[cursor]);
+                    return;
+                }
+            }
+            next.push_back(vertical.size());
+            vertical.push_back({x, y, 1});
+        },
+        [](S32, S32, S32){});
+    return *outline;
+}
+
+Vector<U32> Selection::read(Surface* surface) {
+    U32 count = 0;
+    eachSpan(surface->rect(), [&](S32, S32 x0, S32 x1, U8) {
+        count += x1 - x0;
+    });
+    Vector<U32> pixels;
+    pixels.reserve(count);
+    auto data = surface->data();
+    U32 width = surface->width();
+    eachSpan(surface->rect(), [&](S32 y, S32 x0, S32 x1, U8) {
+        auto row = data + y * width;
+        pixels.insert(pixels.end(), row + x0, row + x1);
+    });
+    return pixels;
+}
+
+void Selection::write(Surface* surface, const Vector<U32>& pixels) {
+    auto data = surface->data();
+    U32 width = surface->width();
+    U32 cursor = 0;
+    Rect dirty;
+    eachSpan(surface->rect(), [&](S32 y, S32 x0, S32 x1, U8) {
+        U32 length = std::min<U32>(x1 - x0, pixels.size() - cursor);
+        std::copy(pixels.begin() + cursor, pixels.begin() + cursor + length, data + y * width + x0);
+        cursor += length;
+        dirty.expand(x0, y);
+        dirty.expand(x1 - 1, y);
+    });
+    if (!dirty.empty())
+        surface->setDirty(dirty);
+}
 
 class SelectionImpl : public Selection {
 public:
+    // Covers capacity, which contains bounds. Bytes outside of bounds are zero.
     Vector<U8> data;
+    Rect capacity;
     Rect bounds;
+    mutable Rect trimmed;
+    mutable bool trimmedIsValid = true;
+    mutable Vector<U8> packed;
+    mutable bool packedIsValid = false;
 
     const Rect& getBounds() const override {return bounds;}
-    const Vector<U8>& getData() const override {return data;}
 
-    void expand(const Rect& rect) {
-        U32 outSize = rect.width * rect.height;
-        swap.resize(outSize);
+    const Vector<U8>& getData() const override {
+        if (capacity.x == bounds.x && capacity.width == bounds.width &&
+            capacity.y == bounds.y && capacity.height == bounds.height)
+            return data;
+        if (!packedIsValid) {
+            packedIsValid = true;
+            packed.resize(bounds.width * bounds.height);
+            for (U32 y = 0; y < bounds.height; ++y) {
+                auto in = at(bounds.x, bounds.y + y);
+                std::copy(in, in + bounds.width, packed.data() + y * bounds.width);
+            }
+        }
+        return packed;
+    }
+
+    U8* at(S32 x, S32 y) {
+        return &data[(y - capacity.y) * capacity.width + (x - capacity.x)];
+    }
+
+    const U8* at(S32 x, S32 y) const {
+        return &data[(y - capacity.y) * capacity.width + (x - capacity.x)];
+    }
 
-        for (auto& old : swap)
-            old = 0;
+    void changed() {
+        invalidateOutline();
+        packedIsValid = false;
+    }
+
+    // Grows the trimmed bounds to include rect. While they are invalid
+    // they still contain every non-zero byte, so a rescan can stay inside them.
+    void expandTrimmed(const Rect& rect) {
+        if (rect.empty())
+            return;
+        trimmed.expand(rect.x, rect.y);
+        trimmed.expand(rect.right() - 1, rect.bottom() - 1);
+    }
+
+    // Sets bounds to rect, which contains them. Capacity grows with
+    // slack on each side that needs it so that a selection extended a
+    // little at a time is only copied O(log n) times.
+    void expand(const Rect& rect) {
+        bool fits = !capacity.empty() &&
+            rect.x >= capacity.x && rect.right() <= capacity.right() &&
+            rect.y >= capacity.y && rect.bottom() <= capacity.bottom();
+        if (fits) {
+            bounds = rect;
+            return;
+        }
 
-        S32 yoffset = bounds.y - rect.y;
-        S32 xoffset = bounds.x - rect.x;
+        Rect grown = rect;
+        if (!capacity.empty()) {
+            S32 slackX = std::max<S32>(16, rect.width / 2);
+            S32 slackY = std::max<S32>(16, rect.height / 2);
+            S32 left = std::min(capacity.x, rect.x < capacity.x ? rect.x - slackX : rect.x);
+            S32 top = std::min(capacity.y, rect.y < capacity.y ? rect.y - slackY : rect.y);
+            S32 right = std::max(capacity.right(), rect.right() > capacity.right() ? rect.right() + slackX : rect.right());
+            S32 bottom = std::max(capacity.bottom(), rect.bottom() > capacity.bottom() ? rect.bottom() + slackY : rect.bottom());
+            grown = Rect{left, top, U32(right - left), U32(bottom - top)};
+        }
 
-        auto out = &swap[yoffset * rect.width + xoffset];
-        auto in = &data[0];
-        U32 width = bounds.width;
+        Vector<U8> grownData(grown.width * grown.height);
         for (U32 y = 0; y < bounds.height; ++y) {
-            for (U32 x = 0; x < width; ++x) {
-                out[x] = in[x];
-            }
-            out += rect.width;
-            in += width;
+            auto in = at(bounds.x, bounds.y + y);
+            auto out = &grownData[(bounds.y + y - grown.y) * grown.width + (bounds.x - grown.x)];
+            std::copy(in, in + bounds.width, out);
         }
 
-        std::swap(data, swap);
+        std::swap(data, grownData);
+        capacity = grown;
         bounds = rect;
     }
 
     Selection& operator = (const Selection& other) override {
+        changed();
         data = other.getData();
         bounds = other.getBounds();
+        capacity = bounds;
+        trimmed = other.getTrimmedBounds();
+        trimmedIsValid = true;
         return *this;
     }
 
     void move(S32 offsetX, S32 offsetY) override {
+        changed();
         bounds.x += offsetX;
         bounds.y += offsetY;
+        capacity.x += offsetX;
+        capacity.y += offsetY;
+        if (!trimmed.empty()) {
+            trimmed.x += offsetX;
+            trimmed.y += offsetY;
+        }
     }
 
     void add(const Selection& other) override {
+        changed();
         Rect otherBounds = other.getBounds();
         Rect newBounds = bounds;
         bool grew = newBounds.expand(otherBounds.x, otherBounds.y);
         grew |= newBounds.expand(otherBounds.right(), otherBounds.bottom());
         if (grew)
             expand(newBounds);
+        expandTrimmed(other.getTrimmedBounds());
         auto& otherData = other.getData();
         for (U32 y = 0; y < otherBounds.height; ++y) {
+            auto in = &otherData[y * otherBounds.width];
+            auto out = at(otherBounds.x, otherBounds.y + y);
             for (U32 x = 0; x < otherBounds.width; ++x) {
-                U32 amount = otherData[y * otherBounds.width + x];
-                if (!amount)
-                    continue;
-                U32 index = (y + (otherBounds.y - bounds.y)) * bounds.width + x + (otherBounds.x - bounds.x);
-                U32 acc = data[index];
-                acc += amount;
-                data[index] = acc > 0xFF ? 0xFF : acc;
+                U32 acc = out[x] + in[x];
+                out[x] = acc > 0xFF ? 0xFF : acc;
             }
         }
     }
 
     void blend(const Selection& other) override {
+        changed();
         Rect otherBounds = other.getBounds();
         Rect newBounds = bounds;
         bool grew = newBounds.expand(otherBounds.x, otherBounds.y);
         grew |= newBounds.expand(otherBounds.right(), otherBounds.bottom());
         if (grew)
             expand(newBounds);
+        expandTrimmed(other.getTrimmedBounds());
         auto& otherData = other.getData();
         for (U32 y = 0; y < otherBounds.height; ++y) {
+            auto in = &otherData[y * otherBounds.width];
+            auto out = at(otherBounds.x, otherBounds.y + y);
             for (U32 x = 0; x < otherBounds.width; ++x) {
-                U32 amount = otherData[y * otherBounds.width + x];
+                U32 amount = in[x];
                 if (!amount)
                     continue;
-                U32 index = (y + (otherBounds.y - bounds.y)) * bounds.width + x + (otherBounds.x - bounds.x);
-                U32 old = data[index];
-                data[index] = old + amount * (255 - old) / 255.0f;
+                U32 old = out[x];
+                out[x] = old + amount * (255 - old) / 255.0f;
             }
         }
     }
 
     Rect getTrimmedBounds() const override {
-        if (bounds.empty())
-            return bounds;
-
-        S32 minX = bounds.right(), minY = bounds.bottom();
-        S32 maxX = bounds.left(), maxY = bounds.top();
-        for (S32 y = bounds.y; y < bounds.bottom(); ++y) {
-            for (S32 x = bounds.x; x < bounds.right(); ++x) {
-                if (!data[(y - bounds.y) * bounds.width + (x - bounds.x)])
+        if (trimmedIsValid)
+            return trimmed;
+
+        S32 minX = trimmed.right(), minY = trimmed.bottom();
+        S32 maxX = trimmed.left() - 1, maxY = trimmed.top() - 1;
+        for (S32 y = trimmed.y; y < trimmed.bottom(); ++y) {
+            auto row = at(trimmed.x, y);
+            for (S32 x = trimmed.x; x < trimmed.right(); ++x) {
+                if (!row[x - trimmed.x])
                     continue;
                 minX = std::min(x, minX);
                 minY = std::min(y, minY);
@@ -109,13 +265,16 @@ public:
             }
         }
 
-        return {
-            minX, minY,
-            U32(maxX - minX + 1), U32(maxY - minY + 1)
-        };
+        trimmedIsValid = true;
+        if (maxX < minX)
+            trimmed = Rect{};
+        else
+            trimmed = Rect{minX, minY, U32(maxX - minX + 1), U32(maxY - minY + 1)};
+        return trimmed;
     }
 
     void mask(const Selection& other) override {
+        changed();
         auto newBounds = getTrimmedBounds();
         newBounds.intersect(other.getTrimmedBounds());
         if (newBounds.empty()) {
@@ -123,60 +282,87 @@ public:
             return;
         }
 
-        swap.resize(newBounds.width * newBounds.height);
+        Vector<U8> masked(newBounds.width * newBounds.height);
+        Rect newTrimmed;
 
         auto& otherData = other.getData();
         auto otherBounds = other.getBounds();
 
         for (S32 y = newBounds.y; y < newBounds.bottom(); ++y) {
-            for (S32 x = newBounds.x; x < newBounds.right(); ++x) {
-                U32 otherAmount = otherData[(y - otherBounds.y) * otherBounds.width + (x - otherBounds.x)];
-                U32 ownAmount = data[(y - bounds.y) * bounds.width + (x - bounds.x)];
-                U32 mul = otherAmount * ownAmount / 255;
-                swap[(y - newBounds.y) * newBounds.width + (x - newBounds.x)] = mul;
+            auto otherRow = &otherData[(y - otherBounds.y) * otherBounds.width + (newBounds.x - otherBounds.x)];
+            auto ownRow = at(newBounds.x, y);
+            auto out = &masked[(y - newBounds.y) * newBounds.width];
+            for (U32 x = 0; x < newBounds.width; ++x) {
+                U32 mul = U32(otherRow[x]) * ownRow[x] / 255;
+                out[x] = mul;
+                if (mul)
+                    newTrimmed.expand(newBounds.x + x, y);
             }
         }
 
-        data = swap;
+        std::swap(data, masked);
         bounds = newBounds;
+        capacity = newBounds;
+        trimmed = newTrimmed;
+        trimmedIsValid = true;
     }
 
     void add(S32 x, S32 y, U32 amount) override {
         if (amount == 0)
             return;
+        changed();
         Rect newBounds = bounds;
         if (newBounds.expand(x, y))
             expand(newBounds);
-        U32 index = (y - bounds.y) * bounds.width + (x - bounds.x);
-        if (index >= data.size()) {
-            logE("Invalid selection add");
-        } else {
-            U32 old = data[index] + amount;
-            data[index] = old > 0xFF ? 0xFF : old;
-        }
+        expandTrimmed({x, y, 1, 1});
+        auto out = at(x, y);
+        U32 old = *out + amount;
+        *out = old > 0xFF ? 0xFF : old;
     }
 
     void add(const Rect& rect, U32 amount) override {
-        if (amount == 0)
+        if (amount == 0 || rect.empty())
             return;
+        changed();
         Rect newBounds = bounds;
         bool didExpand = newBounds.expand(rect.x, rect.y);
         didExpand |= newBounds.expand(rect.right(), rect.bottom());
         if (didExpand)
             expand(newBounds);
-        S32 ydiff = rect.y - bounds.y;
-        S32 xdiff = rect.x - bounds.x;
-        S32 size = data.size();
-        for (S32 y = 0; y < S32(rect.height); ++y) {
-            for (S32 x = 0; x < S32(rect.width); ++x) {
-                U32 index = (y + ydiff) * bounds.width + (x + xdiff);
-                if (index >= size) {
-                    logE("Invalid selection add");
-                } else {
-                    U32 old = data[index] + amount;
-                    data[index] = old > 0xFF ? 0xFF : old;
+        expandTrimmed(rect);
+        for (S32 y = rect.y; y < rect.bottom(); ++y) {
+            auto out = at(rect.x, y);
+            for (U32 x = 0; x < rect.width; ++x) {
+                U32 old = out[x] + amount;
+                out[x] = old > 0xFF ? 0xFF : old;
+            }
+        }
+    }
+
+    void add(const Rect& rect, const U8* amounts, U32 stride) override {
+        if (rect.empty())
+            return;
+        changed();
+        Rect newBounds = bounds;
+        bool didExpand = newBounds.expand(rect.x, rect.y);
+        didExpand |= newBounds.expand(rect.right() - 1, rect.bottom() - 1);
+        if (didExpand)
+            expand(newBounds);
+        for (U32 y = 0; y < rect.height; ++y) {
+            auto in = amounts + y * stride;
+            auto out = at(rect.x, rect.y + y);
+            S32 first = -1, last = -1;
+            for (U32 x = 0; x < rect.width; ++x) {
+                U32 acc = out[x] + in[x];
+                out[x] = acc > 0xFF ? 0xFF : acc;
+                if (in[x]) {
+                    if (first < 0)
+                        first = x;
+                    last = x;
                 }
             }
+            if (first >= 0)
+                expandTrimmed({S32(rect.x + first), S32(rect.y + y), U32(last - first + 1), 1});
         }
     }
 
@@ -185,13 +371,11 @@ public:
             return;
         if (!bounds.contains(x, y))
             return;
-        U32 index = (y - bounds.y) * bounds.width + (x - bounds.x);
-        if (index >= data.size()) {
-            logE("Invalid selection subtract");
-        } else {
-            S32 old = data[index] - amount;
-            data[index] = old < 0 ? 0 : old;
-        }
+        changed();
+        trimmedIsValid = false;
+        auto out = at(x, y);
+        S32 old = *out - amount;
+        *out = old < 0 ? 0 : old;
     }
 
     void subtract(const Rect& rect, U32 amount) override {
@@ -201,18 +385,13 @@ public:
         newBounds.intersect(rect);
         if (newBounds.empty())
             return;
-        S32 ydiff = newBounds.y - bounds.y;
-        S32 xdiff = newBounds.x - bounds.x;
-        S32 size = data.size();
-        for (S32 y = 0; y < S32(newBounds.height); ++y) {
-            for (S32 x = 0; x < S32(newBounds.width); ++x) {
-                U32 index = (y + ydiff) * bounds.width + (x + xdiff);
-                if (index >= size) {
-                    logE("Invalid selection add");
-                } else {
-                    S32 old = data[index] - amount;
-                    data[index] = old < 0 ? 0 : old;
-                }
+        changed();
+        trimmedIsValid = false;
+        for (S32 y = newBounds.y; y < newBounds.bottom(); ++y) {
+            auto out = at(newBounds.x, y);
+            for (U32 x = 0; x < newBounds.width; ++x) {
+                S32 old = out[x] - amount;
+                out[x] = old < 0 ? 0 : old;
             }
         }
     }
@@ -220,52 +399,22 @@ public:
     U8 get(S32 x, S32 y) override {
         if (!bounds.contains(x, y))
             return 0;
-        U32 index = (y - bounds.y) * bounds.width + (x - bounds.x);
-        if (index >= data.size()) {
-            logE("Invalid selection get");
-            return 0;
-        } else {
-            return data[index];
-        }
-    }
-
-    Vector<U32> read(Surface* surface) override {
-        Vector<U32> pixels;
-        S32 minY = std::max<S32>(bounds.y, 0);
-        S32 maxY = std::min<S32>(bounds.bottom(), surface->height());
-        S32 minX = std::max<S32>(bounds.x, 0);
-        S32 maxX = std::min<S32>(bounds.right(), surface->width());
-        for (S32 y = minY; y < maxY; ++y) {
-            U32 index = (y - bounds.y) * bounds.width;
-            if (bounds.x < 0) {
-                index -= bounds.x;
-            }
-            for (S32 x = minX; x < maxX; ++x) {
-                if (data[index++]) {
-                    pixels.push_back(surface->getPixelUnsafe(x, y));
-                }
-            }
-        }
-        return pixels;
+        return *at(x, y);
     }
 
-    void write(Surface* surface, const Vector<U32>& pixels) override {
-        S32 minY = std::max<S32>(bounds.y, 0);
-        S32 maxY = std::min<S32>(bounds.bottom(), surface->height());
-        S32 minX = std::max<S32>(bounds.x, 0);
-        S32 maxX = std::min<S32>(bounds.right(), surface->width());
-        U32 cursor = 0;
-        for (S32 y = minY; y < maxY; ++y) {
-            U32 index = (y - bounds.y) * bounds.width;
-            if (bounds.x < 0) {
-                index -= bounds.x;
-            }
-            for (S32 x = minX; x < maxX; ++x) {
-                if (data[index++]) {
-                    surface->setPixelUnsafe(x, y, pixels[cursor++]);
-                }
-            }
+    const Row& getRow(S32 y, Row& scratch) const override {
+        scratch.clear();
+        if (y < bounds.y || y >= bounds.bottom())
+            return scratch;
+        auto amounts = at(bounds.x, y);
+        for (U32 i = 0; i < bounds.width;) {
+            U8 amount = amounts[i];
+            U32 start = i;
+            while (++i < bounds.width && amounts[i] == amount);
+            if (amount)
+                scratch.push_back({S32(bounds.x + start), i - start, amount});
         }
+        return scratch;
     }
 
     void apply(const Rect& limit, const std::function<void(S32, S32, U8)>& callback) override {
@@ -273,14 +422,9 @@ public:
         S32 maxY = std::min<S32>(bounds.bottom(), limit.bottom());
         S32 minX = std::max<S32>(bounds.x, limit.x);
         S32 maxX = std::min<S32>(bounds.right(), limit.right());
-        S32 skip = 0;
-        if (minX > bounds.x)
-            skip = minX - bounds.x;
-        U32 cursor = 0;
         for (S32 y = minY; y < maxY; ++y) {
-            U32 index = (y - bounds.y) * bounds.width + skip;
             for (S32 x = minX; x < maxX; ++x) {
-                callback(x, y, data[index++]);
+                callback(x, y, *at(x, y));
             }
             callback(maxX, y, 0);
         }
@@ -294,9 +438,14 @@ public:
     }
 
     void clear() override {
+        changed();
         bounds.width = 0;
         bounds.height = 0;
-        data.resize(0);
+        capacity = Rect{};
+        trimmed = Rect{};
+        trimmedIsValid = true;
+        data.clear();
+        packed.clear();
     }
 };
 
@@ -4,12 +4,37 @@
 
 #pragma once
 
+#include <algorithm>
+#include <iterator>
+#include <optional>
+
 #include <common/inject.hpp>
 #include <common/Rect.hpp>
 #include <common/Surface.hpp>
 
 class Selection : public Injectable<Selection>, public std::enable_shared_from_this<Selection> {
 public:
+    // A run of equal, non-zero coverage on a single row
+    struct Span {
+        S32 x;
+        U32 length;
+        U8 amount;
+        S32 end() const {return x + length;}
+    };
+    using Row = Vector<Span>;
+
+    // Unit-thick edges between more and less than half selected pixels.
+    // Horizontal edges run from x to x + length along the top of row y,
+    // vertical edges from y to y + length along the left of column x.
+    struct Outline {
+        struct Edge {
+            S32 x, y;
+            U32 length;
+        };
+        Vector<Edge> horizontal;
+        Vector<Edge> vertical;
+    };
+
     virtual const Rect& getBounds() const = 0;
     virtual Rect getTrimmedBounds() const = 0;
     virtual const Vector<U8>& getData() const = 0;
@@ -20,12 +45,107 @@ public:
     virtual void mask(const Selection& other) = 0;
     virtual void add(S32 x, S32 y, U32 amount) = 0;
     virtual void add(const Rect&, U32 amount) = 0;
+    // Adds rect.width * rect.height amounts, rows are stride bytes apart
+    virtual void add(const Rect& rect, const U8* amounts, U32 stride) = 0;
     virtual void subtract(S32 x, S32 y, U32 amount) = 0;
     virtual void subtract(const Rect& rect, U32 amount) = 0;
     virtual U8 get(S32 x, S32 y) = 0;
-    virtual Vector<U32> read(Surface*) = 0;
-    virtual void write(Surface*, const Vector<U32>& pixels) = 0;
+    // Copies the selected pixels of the surface, in span order
+    virtual Vector<U32> read(Surface*);
+    // Writes back pixels returned by read
+    virtual void write(Surface*, const Vector<U32>& pixels);
     virtual void apply(const Rect& limit, const std::function<void(S32, S32, U8)>& callback) = 0;
     virtual void clear() = 0;
     virtual bool empty() const = 0;
+
+    // Traced on first use, cached until the selection changes
+    const Outline& getOutline() const;
+    void invalidateOutline() {outline.reset();}
+
+    // Returns the spans on row y, sorted by x. May fill and return scratch.
+    virtual const Row& getRow(S32 y, Row& scratch) const = 0;
+
+    // Calls callback(y, spans) for each row of bounds inside limit.
+    // Spans are not clipped horizontally.
+    template<typename Callback>
+    void eachRow(const Rect& limit, Callback&& callback) const {
+        auto& bounds = getBounds();
+        S32 top = std::max<S32>(bounds.y, limit.y);
+        S32 bottom = std::min<S32>(bounds.bottom(), limit.bottom());
+        Row scratch;
+        for (S32 y = top; y < bottom; ++y)
+            callback(y, getRow(y, scratch));
+    }
+
+    // Calls callback(y, x0, x1, amount) for each span, clipped to limit
+    template<typename Callback>
+    void eachSpan(const Rect& limit, Callback&& callback) const {
+        S32 left = limit.x;
+        S32 right = limit.right();
+        eachRow(limit, [&](S32 y, const Row& row) {
+            for (auto& span : row) {
+                S32 x0 = std::max(span.x, left);
+                S32 x1 = std::min(span.end(), right);
+                if (x0 < x1)
+                    callback(y, x0, x1, span.amount);
+            }
+        });
+    }
+
+    // Calls fill(x0, x1, y) for each solid run, then hline(x0, x1, y) for each
+    // horizontal edge above row y and vline(x, y) for each vertical edge on it.
+    template<typename HLine, typename VLine, typename Fill>
+    void traceOutline(const Rect& limit, HLine&& hline, VLine&& vline, Fill&& fill) const {
+        auto& bounds = getBounds();
+        S32 top = std::max<S32>(bounds.y, limit.y);
+        S32 bottom = std::min<S32>(bounds.bottom(), limit.bottom());
+        S32 left = std::max<S32>(bounds.x, limit.x);
+        S32 right = std::min<S32>(bounds.right(), limit.right());
+        if (top >= bottom || left >= right)
+            return;
+
+        Row scratch;
+        Vector<S32> above, current, edges;
+        solidEdges(getRow(top - 1, scratch), left, right, above);
+        for (S32 y = top; y <= bottom; ++y) {
+            if (y < bottom)
+                solidEdges(getRow(y, scratch), left, right, current);
+            else
+                current.clear();
+
+            for (U32 i = 0; i < current.size(); i += 2)
+                fill(current[i], current[i + 1], y);
+
+            // horizontal edges are where exactly one of above and current is solid
+            edges.clear();
+            std::merge(above.begin(), above.end(), current.begin(), current.end(), std::back_inserter(edges));
+            bool inside = false;
+            S32 start = 0;
+            for (U32 i = 0; i < edges.size();) {
+                S32 x = edges[i];
+                U32 toggles = 0;
+                for (; i < edges.size() && edges[i] == x; ++i)
+                    toggles++;
+                if (!(toggles & 1))
+                    continue;
+                if (!inside)
+                    start = x;
+                else
+                    hline(start, x, y);
+                inside = !inside;
+            }
+
+            for (auto x : current)
+                vline(x, y);
+
+            std::swap(above, current);
+        }
+    }
+
+protected:
+    mutable std::optional<Outline> outline;
+
+    // Collects the start and end of each run in row that is more than half
+    // selected, clipped to [left, right)
+    static void solidEdges(const Row& row, S32 left, S32 right, Vector<S32>& out);
 };
@@ -2,9 +2,13 @@
 // This file is released under the terms of the MIT license.
 // Read LICENSE.txt for more information.
 
+#include <array>
+#include <cmath>
+
 #include <common/Surface.hpp>
 #include <doc/Selection.hpp>
 #include <filters/Filter.hpp>
+#include <task/TaskManager.hpp>
 #include <tools/Tool.hpp>
 
 class Surface;
@@ -13,9 +17,12 @@ class Blur : public Filter {
 public:
     Property<S32> radiusX{this, "radius-x", 10};
     Property<S32> radiusY{this, "radius-y", 10};
+    Property<bool> gaussian{this, "gaussian", false};
 
     String category() override {return "blur";}
 
+    bool isThreadSafe() override {return true;}
+
     std::shared_ptr<PropertySet> getMetaProperties() override {
         auto meta = Filter::getMetaProperties();
 
@@ -37,81 +44,116 @@ public:
                     {"resolution", 1}
                 }));
 
+        meta->push(std::make_shared<PropertySet>(PropertySet{
+                    {"widget", "checkbox"},
+                    {"label", gaussian.name},
+                    {"value", gaussian.value}
+                }));
+
         return meta;
     }
 
+    // Box blur with wraparound edges. Keeps a running sum per channel, so
+    // the cost per pixel does not depend on the radius.
+    static void blurLine(U8* out, const U8* line, S32 length, S32 radius, S32 stride) {
+        S32 sum[4] = {};
+        for (S32 w = -radius; w <= radius; ++w) {
+            S32 i = (w % length + length) % length * 4;
+            for (S32 c = 0; c < 4; ++c)
+                sum[c] += line[i + c];
+        }
+
+        U32 scale = 0x10000 / (radius * 2 + 1);
+        S32 add = (radius + 1) % length;
+        S32 sub = (-radius % length + length) % length;
+        for (S32 x = 0; x < length; ++x) {
+            for (S32 c = 0; c < 4; ++c)
+                out[c] = (sum[c] * scale + 0x8000) >> 16;
+            for (S32 c = 0; c < 4; ++c)
+                sum[c] += line[add * 4 + c] - line[sub * 4 + c];
+            if (++add == length) add = 0;
+            if (++sub == length) sub = 0;
+            out += stride;
+        }
+    }
+
+    // Box radii for three passes that approximate a gaussian with the
+    // given standard deviation.
+    static std::array<S32, 3> gaussianRadii(F32 sigma) {
+        constexpr S32 passes = 3;
+        S32 lower = std::sqrt(12 * sigma * sigma / passes + 1);
+        if (!(lower & 1))
+            lower--;
+        S32 upper = lower + 2;
+        F32 ideal = (12 * sigma * sigma - passes * lower * lower - 4 * passes * lower - 3 * passes) / (-4.0f * lower - 4);
+        S32 count = std::round(ideal);
+        std::array<S32, 3> radii;
+        for (S32 i = 0; i < passes; ++i)
+            radii[i] = ((i < count ? lower : upper) - 1) / 2;
+        return radii;
+    }
+
+    // Box radii of the passes along one axis. Small gaussian radii round
+    // every pass down to nothing, those still get a single 3 pixel pass.
+    std::array<S32, 3> passes(S32 radius) {
+        if (!gaussian || radius <= 0)
+            return {std::max<S32>(0, radius), 0, 0};
+        // the radius covers two standard deviations
+        auto radii = gaussianRadii(radius / 2.0f);
+        if (!radii[0] && !radii[1] && !radii[2])
+            radii[2] = 1;
+        return radii;
+    }
+
+    bool supportsRegion() override {return true;}
+
+    U32 regionMargin() override {
+        U32 margin = 0;
+        for (auto pass : passes(std::max<S32>(radiusX, radiusY)))
+            margin += pass;
+        return margin;
+    }
+
     void run(std::shared_ptr<Surface> surface) override {
-        S32 radiusX = this->radiusX;
-        S32 radiusY = this->radiusY;
+        S32 radiusX = std::round(this->radiusX * previewScale);
+        S32 radiusY = std::round(this->radiusY * previewScale);
         if (radiusX == 0 && radiusY == 0)
             return;
 
-        auto data = surface->data();
+        auto data = reinterpret_cast<U8*>(surface->data());
         S32 width = surface->width();
         S32 height = surface->height();
+        if (!width || !height)
+            return;
+
+        auto passesX = passes(radiusX);
+        auto passesY = passes(radiusY);
 
-        Vector<Color> line;
-
-        if (radiusX) {
-            F32 sum = 1.0f / (radiusX * 2 + 1);
-            line.resize(width);
-            for (S32 y = 0; y < height; ++y) {
-                Color c;
-                auto image = data + width * y;
-                for (S32 x = 0; x < width; ++x)
-                    line[x] = image[x];
-                for (S32 x = 0; x < width; ++x) {
-                    U32 r = 0;
-                    U32 g = 0;
-                    U32 b = 0;
-                    U32 a = 0;
-                    for (S32 w = x - radiusX; w <= x + radiusX; ++w) {
-                        S32 rw = w;
-                        while (rw < 0) rw = width + rw;
-                        while (rw >= width) rw -= width;
-                        r += line[rw].r;
-                        g += line[rw].g;
-                        b += line[rw].b;
-                        a += line[rw].a;
-                    }
-                    c.r = r * sum;
-                    c.g = g * sum;
-                    c.b = b * sum;
-                    c.a = a * sum;
-                    image[x] = c.toU32();
+        for (auto radius : passesX) {
+            if (!radius)
+                continue;
+            TaskManager::parallelRange(height, 8, [&](U32 begin, U32 end) {
+                Vector<U8> line(width * 4);
+                for (U32 y = begin; y < end; ++y) {
+                    auto row = data + y * width * 4;
+                    std::copy(row, row + width * 4, line.data());
+                    blurLine(row, line.data(), width, radius, 4);
                 }
-            }
+            });
         }
 
-        if (radiusY) {
-            F32 sum = 1.0f / (radiusY * 2 + 1);
-            line.resize(height);
-            for (S32 x = 0; x < width; ++x) {
-                Color c;
-                for (S32 y = 0; y < height; ++y)
-                    line[y] = data[y * width + x];
-                for (S32 y = 0; y < height; ++y) {
-                    U32 r = 0;
-                    U32 g = 0;
-                    U32 b = 0;
-                    U32 a = 0;
-                    for (S32 w = y - radiusY; w <= y + radiusY; ++w) {
-                        S32 rw = w;
-                        while (rw < 0) rw = height + rw;
-                        while (rw >= height) rw -= height;
-                        c = line[rw];
-                        r += c.r;
-                        g += c.g;
-                        b += c.b;
-                        a += c.a;
-                    }
-                    c.r = r * sum;
-                    c.g = g * sum;
-                    c.b = b * sum;
-                    c.a = a * sum;
-                    data[y * width + x] = c.toU32();
+        for (auto radius : passesY) {
+            if (!radius)
+                continue;
+            TaskManager::parallelRange(width, 16, [&](U32 begin, U32 end) {
+                Vector<U8> line(height * 4);
+                for (U32 x = begin; x < end; ++x) {
+                    auto column = data + x * 4;
+                    for (S32 y = 0; y < height; ++y)
+                        std::copy(column + y * width * 4, column + y * width * 4 + 4, line.data() + y * 4);
+                    blurLine(column, line.data(), height, radius, width * 4);
                 }
-            }
+            });
         }
 
         surface->setDirty(surface->rect());
@@ -105,6 +105,7 @@ public:
         U32 fill = Tool::color.toU32();
         S32 max = std::min<S32>(bounds.width, inwidth);
 
+        Surface::WriteScope writes{*surface};
         for (S32 y = bounds.y; y < bounds.bottom(); ++y) {
             if (U32(y) >= inheight) {
                 for (S32 x = 0; x < bounds.width; ++x)
@@ -123,7 +124,6 @@ public:
             }
         }
 
-        surface->setDirty(surface->rect());
         (*doc)->setDocumentSize(bounds.width, bounds.height);
     }
 
@@ -2,9 +2,12 @@
 // This file is released under the terms of the MIT license.
 // Read LICENSE.txt for more information.
 
+#include <cmath>
+
 #include <common/Surface.hpp>
 #include <doc/Selection.hpp>
 #include <filters/Filter.hpp>
+#include <task/TaskManager.hpp>
 #include <tools/Tool.hpp>
 
 class Surface;
@@ -14,8 +17,12 @@ public:
     Property<S32> offsetX{this, "offset-x", 0};
     Property<S32> offsetY{this, "offset-y", 0};
     Property<Color> shadowColor{this, "shadow-color", "rgba{0,0,0,255}"};
+    Property<S32> blur{this, "shadow-blur", 0};
+    Property<S32> spread{this, "shadow-spread", 0};
     String category() override {return "misc";}
 
+    bool isThreadSafe() override {return true;}
+
     std::shared_ptr<PropertySet> getMetaProperties() override {
         auto meta = Filter::getMetaProperties();
         meta->push(std::make_shared<PropertySet>(PropertySet{
@@ -33,75 +40,152 @@ public:
                     {"label", shadowColor.name},
                     {"value", shadowColor.value = Tool::color}
                 }));
+        meta->push(std::make_shared<PropertySet>(PropertySet{
+                    {"widget", "range"},
+                    {"label", blur.name},
+                    {"value", blur.value},
+                    {"min", 0},
+                    {"max", 100},
+                    {"resolution", 1}
+                }));
+        meta->push(std::make_shared<PropertySet>(PropertySet{
+                    {"widget", "range"},
+                    {"label", spread.name},
+                    {"value", spread.value},
+                    {"min", 0},
+                    {"max", 100},
+                    {"resolution", 1}
+                }));
         return meta;
     }
 
+    // Largest value within radius of each element, zero past the ends.
+    static void spreadLine(U8* out, const U8* line, S32 length, S32 radius, S32 stride, Vector<S32>& queue) {
+        queue.resize(length);
+        S32 head = 0, tail = 0;
+        for (S32 i = 0; i < length + radius; ++i) {
+            if (i < length) {
+                while (tail > head && line[queue[tail - 1]] <= line[i])
+                    tail--;
+                queue[tail++] = i;
+            }
+            S32 o = i - radius;
+            if (o < 0)
+                continue;
+            while (queue[head] < o - radius)
+                head++;
+            out[o * stride] = line[queue[head]];
+        }
+    }
+
+    // Running-sum box blur, zero past the ends.
+    static void blurLine(U8* out, const U8* line, S32 length, S32 radius, S32 stride) {
+        U32 sum = 0;
+        for (S32 i = 0; i <= radius && i < length; ++i)
+            sum += line[i];
+        U32 scale = 0x10000 / (radius * 2 + 1);
+        for (S32 x = 0; x < length; ++x) {
+            out[x * stride] = (sum * scale + 0x8000) >> 16;
+            if (x + radius + 1 < length)
+                sum += line[x + radius + 1];
+            if (x - radius >= 0)
+                sum -= line[x - radius];
+        }
+    }
+
+    bool supportsRegion() override {return true;}
+
+    U32 regionMargin() override {
+        S32 offset = std::max(std::abs(*offsetX), std::abs(*offsetY));
+        return offset + std::max<S32>(0, blur) + std::max<S32>(0, spread);
+    }
+
     void run(std::shared_ptr<Surface> surface) override {
-        S32 offsetX = this->offsetX;
-        S32 offsetY = this->offsetY;
-        if (offsetX == 0 && offsetY == 0)
+        S32 offsetX = std::round(this->offsetX * previewScale);
+        S32 offsetY = std::round(this->offsetY * previewScale);
+        S32 blur = std::max<S32>(0, std::round(this->blur * previewScale));
+        S32 spread = std::max<S32>(0, std::round(this->spread * previewScale));
+        if (offsetX == 0 && offsetY == 0 && !blur && !spread)
             return;
 
-        S32 signX = offsetX < 0 ? -1 : offsetX > 0;
-        S32 signY = offsetY < 0 ? -1 : offsetY > 0;
-        S32 absX = std::abs(offsetX);
-        S32 absY = std::abs(offsetY);
-
-        auto write = surface->data();
-        auto width = surface->width();
-        auto height = surface->height();
-        U8 colorR = shadowColor->r;
-        U8 colorG = shadowColor->g;
-        U8 colorB = shadowColor->b;
-        U8 colorA = shadowColor->a;
-
-        U32 startY = 0;
-        U32 endY = height;
-        if (offsetY < 0) {
-            startY = -signY;
-            endY = height;
-        } else if (offsetY > 0) {
-            startY = 0;
-            endY = height - signY;
-        }
+        auto data = surface->data();
+        S32 width = surface->width();
+        S32 height = surface->height();
+        if (!width || !height)
+            return;
 
-        U32 startX = 0;
-        U32 endX = width;
-        if (offsetX < 0) {
-            startX = -signX;
-            endX = width;
-        } else if (offsetX > 0) {
-            startX = 0;
-            endX = width - signX;
-        }
+        Color color = *shadowColor;
 
-        Vector<Surface::PixelType> src;
-        while (absX || absY) {
-            S32 dirX = 0, dirY = 0;
-            if (absX) {
-                absX--;
-                dirX = signX;
-            } else {
-                absY--;
-                dirY = signY;
-            }
-            src = surface->getPixels();
-            for (U32 y = startY; y < endY; ++y) {
-                for (U32 x = startX; x < endX; ++x) {
-                    Color pixel{src[(y + dirY) * width + (x + dirX)]};
-                    Color previous{src[y * width + x]};
-                    F32 alpha = previous.a / 255.0f;
-                    U8 shadownAlpha = colorA * (pixel.a / 255.0f);
-                    write[y * width + x] = Color{
-                        U8(colorR * (1 - alpha) + previous.r * alpha),
-                        U8(colorG * (1 - alpha) + previous.g * alpha),
-                        U8(colorB * (1 - alpha) + previous.b * alpha),
-                        U8(shadownAlpha + alpha * (255 - shadownAlpha)),
-                    }.toU32();
+        // The shadow is the alpha channel, shifted by the offset.
+        Vector<U8> mask(width * height);
+        TaskManager::parallelRange(height, 16, [&](U32 begin, U32 end) {
+            for (S32 y = begin; y < S32(end); ++y) {
+                S32 sy = y + offsetY;
+                auto out = mask.data() + y * width;
+                if (sy < 0 || sy >= height) {
+                    std::fill(out, out + width, 0);
+                    continue;
+                }
+                auto in = data + sy * width;
+                for (S32 x = 0; x < width; ++x) {
+                    S32 sx = x + offsetX;
+                    out[x] = sx >= 0 && sx < width ? Color{in[sx]}.a : 0;
                 }
             }
+        });
+
+        auto eachLine = [&](auto&& op) {
+            TaskManager::parallelRange(height, 16, [&](U32 begin, U32 end) {
+                Vector<U8> line(width);
+                for (U32 y = begin; y < end; ++y) {
+                    auto row = mask.data() + y * width;
+                    std::copy(row, row + width, line.data());
+                    op(row, line.data(), width, 1);
+                }
+            });
+            TaskManager::parallelRange(width, 16, [&](U32 begin, U32 end) {
+                Vector<U8> line(height);
+                for (U32 x = begin; x < end; ++x) {
+                    for (S32 y = 0; y < height; ++y)
+                        line[y] = mask[y * width + x];
+                    op(mask.data() + x, line.data(), height, width);
+                }
+            });
+        };
+
+        if (spread) {
+            eachLine([&](U8* out, const U8* line, S32 length, S32 stride) {
+                thread_local Vector<S32> queue;
+                spreadLine(out, line, length, spread, stride, queue);
+            });
         }
 
+        if (blur) {
+            eachLine([&](U8* out, const U8* line, S32 length, S32 stride) {
+                blurLine(out, line, length, blur, stride);
+            });
+        }
+
+        // Composite the surface over its shadow.
+        TaskManager::parallelRange(height, 16, [&](U32 begin, U32 end) {
+            for (U32 i = begin * width, max = end * width; i < max; ++i) {
+                U32 shadowA = mask[i] * color.a / 255;
+                if (!shadowA)
+                    continue;
+                Color pixel{data[i]};
+                if (pixel.a == 255)
+                    continue;
+                U32 under = shadowA * (255 - pixel.a) / 255;
+                U32 alpha = pixel.a + under;
+                data[i] = Color{
+                    U8((pixel.r * pixel.a + color.r * under) / alpha),
+                    U8((pixel.g * pixel.a + color.g * under) / alpha),
+                    U8((pixel.b * pixel.a + color.b * under) / alpha),
+                    U8(alpha)
+                }.toU32();
+            }
+        });
+
         surface->setDirty(surface->rect());
     }
 };
@@ -0,0 +1,67 @@
+// Copyright (c) 2021 LibreSprite Authors (cf. AUTHORS.md)
+// This file is released under the terms of the MIT license.
+// Read LICENSE.txt for more information.
+
+#include <common/Surface.hpp>
+#include <doc/Selection.hpp>
+#include <filters/Filter.hpp>
+
+void Filter::runRegion(std::shared_ptr<Surface> surface, const Rect& roi, const Selection& mask) {
+    Rect region = roi;
+    region.intersect(surface->rect());
+    if (region.empty())
+        return;
+
+    // Kernels may wrap around the edges of what they are given. When the
+    // margin reaches an edge of the surface the crop spans that whole axis,
+    // so anything that wraps lands where it would in a full run.
+    S32 margin = regionMargin();
+    S32 width = surface->width();
+    S32 height = surface->height();
+    S32 left = region.x - margin, right = region.right() + margin;
+    S32 top = region.y - margin, bottom = region.bottom() + margin;
+    if (left <= 0 || right >= width) {
+        left = 0;
+        right = width;
+    }
+    if (top <= 0 || bottom >= height) {
+        top = 0;
+        bottom = height;
+    }
+    Rect crop{left, top, U32(right - left), U32(bottom - top)};
+
+    auto data = surface->data();
+    U32 stride = surface->width();
+    auto tmp = std::make_shared<Surface>();
+    tmp->resize(crop.width, crop.height);
+    auto cropped = tmp->data();
+    for (U32 y = 0; y < crop.height; ++y) {
+        auto row = data + (crop.y + y) * stride + crop.x;
+        std::copy(row, row + crop.width, cropped + y * crop.width);
+    }
+
+    run(tmp);
+    if (tmp->width() != crop.width || tmp->height() != crop.height)
+        return;
+    cropped = tmp->data();
+
+    mask.eachSpan(region, [&](S32 y, S32 x0, S32 x1, U8 amount) {
+        auto dst = data + y * stride;
+        auto src = cropped + (y - crop.y) * crop.width - crop.x;
+        if (amount == 255) {
+            std::copy(src + x0, src + x1, dst + x0);
+            return;
+        }
+        for (S32 x = x0; x < x1; ++x) {
+            Surface::PixelType out = 0;
+            for (U32 shift = 0; shift < 32; shift += 8) {
+                U32 before = (dst[x] >> shift) & 0xFF;
+                U32 after = (src[x] >> shift) & 0xFF;
+                out |= ((before * (255 - amount) + after * amount + 127) / 255) << shift;
+            }
+            dst[x] = out;
+        }
+    });
+
+    surface->setDirty(region);
+}
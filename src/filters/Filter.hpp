@@ -6,8 +6,10 @@
 
 #include <common/Color.hpp>
 #include <common/PropertySet.hpp>
+#include <common/Rect.hpp>
 #include <common/inject.hpp>
 
+class Selection;
 class Surface;
 
 class Filter : public Injectable<Filter>, public Model, public std::enable_shared_from_this<Filter> {
@@ -26,9 +28,15 @@ public:
     Property<bool> allLayers{this, "all-layers", false};
     Property<bool> allFrames{this, "all-frames", false};
     std::shared_ptr<PropertySet> undoData;
+    // Previews run on a downsampled copy of the cell. Filters multiply
+    // their sizes and offsets in pixels by this to match.
+    F32 previewScale = 1;
 
     virtual bool forceAllLayers() {return false;}
     virtual bool forceAllFrames() {return false;}
+    // True when run only touches the surface it is given, so several
+    // cells can be filtered at once on worker threads.
+    virtual bool isThreadSafe() {return false;}
     virtual String category() = 0;
 
     virtual void init(const String& name) {
@@ -61,7 +69,15 @@ public:
         return meta;
     }
 
+    // Filters that only read pixels up to regionMargin() away from the ones
+    // they write can be limited to a selection.
+    virtual bool supportsRegion() {return false;}
+    virtual U32 regionMargin() {return 0;}
+
     virtual void beforeRun() {}
     virtual void run(std::shared_ptr<Surface> surface) = 0;
+    // Only changes the pixels in roi, blending the filtered ones in by the
+    // coverage of mask. The default runs on a crop of roi plus the margin.
+    virtual void runRegion(std::shared_ptr<Surface> surface, const Rect& roi, const Selection& mask);
     virtual void afterRun() {}
 };
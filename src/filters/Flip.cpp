@@ -11,6 +11,8 @@ class Flip : public Filter {
 public:
     String category() override {return "transform";}
 
+    bool isThreadSafe() override {return true;}
+
     void run(std::shared_ptr<Surface> surface) override {
         auto data = surface->data();
         S32 width = surface->width();
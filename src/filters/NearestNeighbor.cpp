@@ -5,6 +5,7 @@
 #include <common/Surface.hpp>
 #include <doc/Document.hpp>
 #include <filters/Filter.hpp>
+#include <filters/PixelScaler.hpp>
 
 class Surface;
 
@@ -66,11 +67,17 @@ public:
 
         surface->resize(outwidth, outheight);
 
-        for (S32 y = 0; y < outheight; ++y) {
-            U32 yi = (y * inheight / outheight) * inwidth;
+        Vector<U32> columns(outwidth);
+        for (S32 x = 0; x < outwidth; ++x)
+            columns[x] = U64(x) * inwidth / outwidth;
+
+        auto out = surface->data();
+        PixelScaler::eachRow(outheight, [&](S32 y) {
+            auto src = data.data() + (U64(y) * inheight / outheight) * inwidth;
+            auto dst = out + y * outwidth;
             for (S32 x = 0; x < outwidth; ++x)
-                surface->setPixelUnsafe(x, y, data[yi + (x * inwidth / outwidth)]);
-        }
+                dst[x] = src[columns[x]];
+        });
 
         surface->setDirty(surface->rect());
         (*doc)->setDocumentSize(outwidth, outheight);
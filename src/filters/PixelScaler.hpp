@@ -0,0 +1,71 @@
+// Copyright (c) 2021 LibreSprite Authors (cf. AUTHORS.md)
+// This file is released under the terms of the MIT license.
+// Read LICENSE.txt for more information.
+
+#pragma once
+
+#include <common/Surface.hpp>
+#include <doc/Document.hpp>
+#include <filters/Filter.hpp>
+#include <task/TaskManager.hpp>
+
+// Base for the fixed-factor pixel art upscalers. Subclasses read the
+// source pixels and write straight into the resized surface, the whole
+// surface is marked dirty once at the end.
+class PixelScaler : public Filter {
+public:
+    using PixelType = Surface::PixelType;
+
+    Property<Document*> doc{this, "document"};
+
+    bool forceAllLayers() override {return true;}
+    bool forceAllFrames() override {return true;}
+
+    String category() override {return "resize";}
+
+    std::shared_ptr<PropertySet> getMetaProperties() override {return nullptr;}
+
+    virtual U32 factor() = 0;
+
+    // Writes the factor() x factor() block of every source pixel into out,
+    // which is width * factor() pixels wide.
+    virtual void scale(const PixelType* in, S32 width, S32 height, PixelType* out) = 0;
+
+    void undo() override {
+        (*doc)->setDocumentSize((*doc)->width() / factor(), (*doc)->height() / factor());
+    }
+
+    void run(std::shared_ptr<Surface> surface) override {
+        auto data = surface->getPixels();
+        S32 width = surface->width();
+        S32 height = surface->height();
+        S32 outwidth = width * factor();
+        S32 outheight = height * factor();
+
+        if (!undoData) {
+            undoData = std::make_shared<PropertySet>();
+        }
+
+        surface->resize(outwidth, outheight);
+        if (width && height)
+            scale(data.data(), width, height, surface->data());
+
+        surface->setDirty(surface->rect());
+        (*doc)->setDocumentSize(outwidth, outheight);
+    }
+
+    // Calls job(y) for every row in [0, height), split across the TaskManager
+    // when there is one.
+    template<typename Job>
+    static void eachRow(S32 height, Job&& job) {
+        TaskManager::parallelRange(height, 16, [&](U32 begin, U32 end) {
+            for (U32 y = begin; y < end; ++y)
+                job(S32(y));
+        });
+    }
+
+    // Source row y, clamped to the image.
+    static const PixelType* row(const PixelType* in, S32 width, S32 height, S32 y) {
+        return in + std::clamp<S32>(y, 0, height - 1) * width;
+    }
+};
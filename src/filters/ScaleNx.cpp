@@ -0,0 +1,93 @@
+// Copyright (c) 2021 LibreSprite Authors (cf. AUTHORS.md)
+// This file is released under the terms of the MIT license.
+// Read LICENSE.txt for more information.
+
+#include <filters/PixelScaler.hpp>
+
+class Scale2X : public PixelScaler {
+public:
+    U32 factor() override {return 2;}
+
+    static void scale2x(const PixelType* in, S32 width, S32 height, PixelType* out) {
+        S32 outwidth = width * 2;
+        eachRow(height, [&](S32 y) {
+            auto up = row(in, width, height, y - 1);
+            auto mid = row(in, width, height, y);
+            auto down = row(in, width, height, y + 1);
+            auto out0 = out + y * 2 * outwidth;
+            auto out1 = out0 + outwidth;
+            for (S32 x = 0; x < width; ++x) {
+                S32 xl = std::max<S32>(0, x - 1);
+                S32 xr = std::min<S32>(width - 1, x + 1);
+                auto u = up[x], l = mid[xl], c = mid[x], r = mid[xr], d = down[x];
+
+                out0[x * 2    ] = l == u && u != r && l != d ? l : c;
+                out0[x * 2 + 1] = r == u && u != l && r != d ? r : c;
+                out1[x * 2    ] = l == d && u != l && r != d ? l : c;
+                out1[x * 2 + 1] = r == d && u != r && l != d ? r : c;
+            }
+        });
+    }
+
+    void scale(const PixelType* in, S32 width, S32 height, PixelType* out) override {
+        scale2x(in, width, height, out);
+    }
+};
+
+class Scale3X : public PixelScaler {
+public:
+    U32 factor() override {return 3;}
+
+    void scale(const PixelType* in, S32 width, S32 height, PixelType* out) override {
+        S32 outwidth = width * 3;
+        eachRow(height, [&](S32 y) {
+            auto up = row(in, width, height, y - 1);
+            auto mid = row(in, width, height, y);
+            auto down = row(in, width, height, y + 1);
+            auto out0 = out + y * 3 * outwidth;
+            auto out1 = out0 + outwidth;
+            auto out2 = out1 + outwidth;
+            for (S32 x = 0; x < width; ++x) {
+                S32 xl = std::max<S32>(0, x - 1);
+                S32 xr = std::min<S32>(width - 1, x + 1);
+                auto a = up[xl],   b = up[x],   c = up[xr];
+                auto d = mid[xl],  e = mid[x],  f = mid[xr];
+                auto g = down[xl], h = down[x], i = down[xr];
+                auto o0 = out0 + x * 3, o1 = out1 + x * 3, o2 = out2 + x * 3;
+
+                if (b == h || d == f) {
+                    o0[0] = o0[1] = o0[2] = e;
+                    o1[0] = o1[1] = o1[2] = e;
+                    o2[0] = o2[1] = o2[2] = e;
+                    continue;
+                }
+
+                o0[0] = d == b ? d : e;
+                o0[1] = (d == b && e != c) || (b == f && e != a) ? b : e;
+                o0[2] = b == f ? f : e;
+                o1[0] = (d == b && e != g) || (d == h && e != a) ? d : e;
+                o1[1] = e;
+                o1[2] = (b == f && e != i) || (h == f && e != c) ? f : e;
+                o2[0] = d == h ? d : e;
+                o2[1] = (d == h && e != i) || (h == f && e != g) ? h : e;
+                o2[2] = h == f ? f : e;
+            }
+        });
+    }
+};
+
+// Scale2x applied twice, as in the reference implementation.
+class Scale4X : public PixelScaler {
+public:
+    U32 factor() override {return 4;}
+
+    void scale(const PixelType* in, S32 width, S32 height, PixelType* out) override {
+        Vector<PixelType> half(width * 2 * height * 2);
+        Scale2X::scale2x(in, width, height, half.data());
+        Scale2X::scale2x(half.data(), width * 2, height * 2, out);
+    }
+};
+
+static Filter::Shared<Scale2X> reg2x{"scale2x"};
+static Filter::Shared<Scale3X> reg3x{"scale3x"};
+static Filter::Shared<Scale4X> reg4x{"scale4x"};
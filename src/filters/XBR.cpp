@@ -0,0 +1,140 @@
+// Copyright (c) 2021 LibreSprite Authors (cf. AUTHORS.md)
+// This file is released under the terms of the MIT license.
+// Read LICENSE.txt for more information.
+
+#include <cstdlib>
+
+#include <common/Color.hpp>
+#include <filters/PixelScaler.hpp>
+
+// 2xBR by Hyllian: looks at a 5x5 window around each pixel, finds the
+// dominant edge direction at every corner and blends the corner's output
+// pixels towards the neighbor across that edge.
+class XBR2X : public PixelScaler {
+public:
+    U32 factor() override {return 2;}
+
+    // Color distance in YUV space, weighted like the reference. Alpha
+    // counts as much as luma so sprite outlines are detected too.
+    static S32 distance(PixelType A, PixelType B) {
+        S32 r = S32((A >> Color::Rshift) & 0xFF) - S32((B >> Color::Rshift) & 0xFF);
+        S32 g = S32((A >> Color::Gshift) & 0xFF) - S32((B >> Color::Gshift) & 0xFF);
+        S32 b = S32((A >> Color::Bshift) & 0xFF) - S32((B >> Color::Bshift) & 0xFF);
+        S32 a = S32((A >> Color::Ashift) & 0xFF) - S32((B >> Color::Ashift) & 0xFF);
+        S32 y = (299 * r + 587 * g + 114 * b) / 1000;
+        S32 u = (-169 * r - 331 * g + 500 * b) / 1000;
+        S32 v = (500 * r - 419 * g - 81 * b) / 1000;
+        return 48 * (std::abs(y) + std::abs(a)) + 7 * std::abs(u) + 6 * std::abs(v);
+    }
+
+    static bool same(PixelType A, PixelType B) {
+        return distance(A, B) < 155;
+    }
+
+    static void rotate(S32& dx, S32& dy, U32 rotation) {
+        for (U32 i = 0; i < rotation; ++i) {
+            S32 t = dx;
+            dx = dy;
+            dy = -t;
+        }
+    }
+
+    // Moves dst weight/256 of the way towards src, on all four channels.
+    static void blend(PixelType& dst, PixelType src, U32 weight) {
+        PixelType out = 0;
+        for (U32 shift = 0; shift < 32; shift += 8) {
+            U32 d = (dst >> shift) & 0xFF;
+            U32 s = (src >> shift) & 0xFF;
+            out |= ((d * (256 - weight) + s * weight) >> 8) << shift;
+        }
+        dst = out;
+    }
+
+    void scale(const PixelType* in, S32 width, S32 height, PixelType* out) override {
+        S32 outwidth = width * 2;
+        eachRow(height, [&](S32 y) {
+            const PixelType* rows[5];
+            for (S32 i = 0; i < 5; ++i)
+                rows[i] = row(in, width, height, y + i - 2);
+            auto out0 = out + y * 2 * outwidth;
+            auto out1 = out0 + outwidth;
+
+            for (S32 x = 0; x < width; ++x) {
+                PixelType window[5][5];
+                for (S32 i = 0; i < 5; ++i) {
+                    for (S32 j = 0; j < 5; ++j)
+                        window[i][j] = rows[i][std::clamp<S32>(x + j - 2, 0, width - 1)];
+                }
+
+                PixelType E[4];
+                E[0] = E[1] = E[2] = E[3] = window[2][2];
+
+                // The rule is written for the bottom-right corner. The other
+                // corners use the same rule on the window rotated by 90
+                // degrees each time, (dx, dy) -> (dy, -dx).
+                for (U32 rotation = 0; rotation < 4; ++rotation) {
+                    auto P = [&](S32 dx, S32 dy) {
+                        rotate(dx, dy, rotation);
+                        return window[dy + 2][dx + 2];
+                    };
+                    auto quadrant = [&](S32 dx, S32 dy) {
+                        rotate(dx, dy, rotation);
+                        return (dy > 0) * 2 + (dx > 0);
+                    };
+                    corner(P, E[quadrant(1, 1)], E[quadrant(-1, 1)], E[quadrant(1, -1)]);
+                }
+
+                out0[x * 2    ] = E[0];
+                out0[x * 2 + 1] = E[1];
+                out1[x * 2    ] = E[2];
+                out1[x * 2 + 1] = E[3];
+            }
+        });
+    }
+
+    // corner is the output pixel at (+1, +1), left the one at (-1, +1) and
+    // up the one at (+1, -1).
+    template<typename Window>
+    static void corner(const Window& P, PixelType& corner, PixelType& left, PixelType& up) {
+        auto PE = P(0, 0), PH = P(0, 1), PF = P(1, 0);
+        if (PE == PH || PE == PF)
+            return;
+
+        auto PB = P(0, -1), PC = P(1, -1);
+        auto PD = P(-1, 0), PG = P(-1, 1), PI = P(1, 1);
+        auto F4 = P(2, 0), I4 = P(2, 1), H5 = P(0, 2), I5 = P(1, 2);
+
+        S32 e = distance(PE, PC) + distance(PE, PG) + distance(PI, H5) + distance(PI, F4) + 4 * distance(PH, PF);
+        S32 i = distance(PH, PD) + distance(PH, I5) + distance(PF, I4) + distance(PF, PB) + 4 * distance(PE, PI);
+        auto px = distance(PE, PF) <= distance(PE, PH) ? PF : PH;
+
+        bool edge = (!same(PF, PB) && !same(PH, PD))
+            || (same(PE, PI) && !same(PF, I4) && !same(PH, I5))
+            || same(PE, PG)
+            || same(PE, PC);
+
+        if (e < i && edge) {
+            S32 ke = distance(PF, PG);
+            S32 ki = distance(PH, PC);
+            bool shallow = ke * 2 <= ki && PE != PG && PD != PG;
+            bool steep = ke >= ki * 2 && PE != PC && PB != PC;
+            if (shallow && steep) {
+                blend(corner, px, 224);
+                blend(left, px, 64);
+                up = left;
+            } else if (shallow) {
+                blend(corner, px, 192);
+                blend(left, px, 64);
+            } else if (steep) {
+                blend(corner, px, 192);
+                blend(up, px, 64);
+            } else {
+                blend(corner, px, 128);
+            }
+        } else if (e <= i) {
+            blend(corner, px, 128);
+        }
+    }
+};
+
+static Filter::Shared<XBR2X> reg{"xbr2x"};
@@ -87,6 +87,6 @@ public:
     U64 write(const void* buffer, U64 size) override {
         if (!file)
             return 0;
-        return fwrite(buffer, size, 1, file);
+        return fwrite(buffer, 1, size, file);
     }
 };
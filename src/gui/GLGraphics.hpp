@@ -35,6 +35,10 @@ public:
     F32 iheight = 0;
     Rect dirtyRegion{0, 0, ~U32{}, ~U32{}};
 
+    // Pixel buffers used in turn for streaming uploads, see GLGraphics::usePBO
+    U32 pbo[2] = {};
+    U32 pboIndex = 0;
+
     GLTexture() {
         glGenTextures(1, &id);
     }
@@ -42,6 +46,8 @@ public:
     ~GLTexture() {
         if (id)
             glDeleteTextures(1, &id);
+        if (pbo[0])
+            glDeleteBuffers(2, pbo);
     }
 
     void setDirty(const Rect& region) override {
@@ -117,6 +123,10 @@ public:
 
     U32 empty = 0;
 
+    // Stream partial uploads through pixel buffer objects instead of
+    // handing client memory straight to glTexSubImage2D.
+    bool usePBO = false;
+
     Object& getObject() {
         if (currentObject == objects.size()) {
             objects.push_back(std::make_shared<Object>());
@@ -326,24 +336,90 @@ public:
     void upload(Surface& surface, GLTexture* texture) {
         PROFILER
         texture->bind(GL_TEXTURE_2D);
-        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
-        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
-        // TODO: Use dirtyRegion to upload only what changed
-        PROFILER_CALL(glTexImage2D(GL_TEXTURE_2D,
-                     0,
-                     GL_RGBA,
-                     surface.width(),
-                     surface.height(),
-                     0,
-                     GL_RGBA,
-                     GL_UNSIGNED_BYTE,
-                     surface.data()));
-        texture->width = surface.width();
-        texture->iwidth = 1.0f / texture->width;
-        texture->height = surface.height();
-        texture->iheight = 1.0f / texture->height;
-        // glGenerateMipmap(GL_TEXTURE_2D);
+
+        if (texture->width != surface.width() || texture->height != surface.height()) {
+            glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+            glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+            PROFILER_CALL(glTexImage2D(GL_TEXTURE_2D,
+                                       0,
+                                       GL_RGBA,
+                                       surface.width(),
+                                       surface.height(),
+                                       0,
+                                       GL_RGBA,
+                                       GL_UNSIGNED_BYTE,
+                                       surface.data()));
+            texture->width = surface.width();
+            texture->iwidth = 1.0f / texture->width;
+            texture->height = surface.height();
+            texture->iheight = 1.0f / texture->height;
+            // glGenerateMipmap(GL_TEXTURE_2D);
+            texture->dirtyRegion = Rect{};
+            return;
+        }
+
+        // Same storage as last time, only send what changed.
+        auto region = texture->dirtyRegion;
+        region.intersect(surface.rect());
         texture->dirtyRegion = Rect{};
+        if (region.empty())
+            return;
+
+        auto pixels = surface.data() + region.y * surface.width() + region.x;
+
+        if (!usePBO) {
+            glPixelStorei(GL_UNPACK_ROW_LENGTH, surface.width());
+            PROFILER_CALL(glTexSubImage2D(GL_TEXTURE_2D,
+                                          0,
+                                          region.x,
+                                          region.y,
+                                          region.width,
+                                          region.height,
+                                          GL_RGBA,
+                                          GL_UNSIGNED_BYTE,
+                                          pixels));
+            glPixelStorei(GL_UNPACK_ROW_LENGTH, 0);
+            return;
+        }
+
+        if (!texture->pbo[0])
+            glGenBuffers(2, texture->pbo);
+
+        // Alternate buffers so this copy doesn't wait for the previous
+        // transfer. Reallocating the store orphans whatever the driver
+        // still reads from.
+        auto size = region.width * region.height * sizeof(Surface::PixelType);
+        texture->pboIndex ^= 1;
+        glBindBuffer(GL_PIXEL_UNPACK_BUFFER, texture->pbo[texture->pboIndex]);
+        glBufferData(GL_PIXEL_UNPACK_BUFFER, size, nullptr, GL_STREAM_DRAW);
+        auto mapped = static_cast<Surface::PixelType*>(glMapBufferRange(GL_PIXEL_UNPACK_BUFFER,
+                                                                        0,
+                                                                        size,
+                                                                        GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_BUFFER_BIT));
+        if (mapped) {
+            for (U32 y = 0; y < region.height; ++y) {
+                auto row = pixels + y * surface.width();
+                std::copy(row, row + region.width, mapped + y * region.width);
+            }
+            glUnmapBuffer(GL_PIXEL_UNPACK_BUFFER);
+            PROFILER_CALL(glTexSubImage2D(GL_TEXTURE_2D,
+                                          0,
+                                          region.x,
+                                          region.y,
+                                          region.width,
+                                          region.height,
+                                          GL_RGBA,
+                                          GL_UNSIGNED_BYTE,
+                                          nullptr));
+        } else {
+            logE("Could not map pixel buffer, disabling PBO uploads");
+            usePBO = false;
+            glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+            texture->dirtyRegion = region;
+            upload(surface, texture);
+            return;
+        }
+        glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
     }
 
     struct Vertex {
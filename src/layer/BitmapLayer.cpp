@@ -38,21 +38,23 @@ public:
         if (preview.draw == Tool::Preview::drawOutlineAnts)
             preview.draw(false, preview, *overlayLayer(), offsetCanvas(), overlayScale());
 
-        clearSelectionOverlay();
-
         auto cell = dynamic_cast<BitmapCell*>(&this->cell());
-        if (!cell)
-            return;
-
-        auto selection = cell->getSelection();
+        auto selection = cell ? cell->getSelection() : nullptr;
         if (!selection || selection->empty()) {
-            this->selection.reset();
+            clearSelectionOverlay();
             return;
         }
 
-        this->selection = selection->shared_from_this();
-        selectionGlobalCanvas = offsetCanvas();
-        selectionScale = overlayScale();
+        // the outline is cached on the selection, so while neither it nor
+        // the view changes the ants are re-stroked in place
+        auto canvas = offsetCanvas();
+        auto scale = overlayScale();
+        if (this->selection.get() != selection || !(selectionGlobalCanvas == canvas) || selectionScale != scale) {
+            clearSelectionOverlay();
+            this->selection = selection->shared_from_this();
+            selectionGlobalCanvas = canvas;
+            selectionScale = scale;
+        }
 
         Tool::Preview preview {
             .overlay = this->selection,
@@ -149,6 +151,7 @@ public:
         if (event.selection == selection.get()) {
             clearSelectionOverlay();
         }
+        event.selection->invalidateOutline();
     }
 
     void updateToolOverlay() {
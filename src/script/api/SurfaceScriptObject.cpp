@@ -12,6 +12,9 @@
 class SurfaceScriptObject : public script::ScriptObject {
     std::shared_ptr<Surface> surface;
 
+    // setPixel calls made during one eval share a single dirty rect
+    std::weak_ptr<Surface::WriteScope> writes;
+
 public:
     SurfaceScriptObject() {
         addProperty("width",
@@ -40,6 +43,7 @@ public:
 
     void setWrapped(const Value& value) override {
         surface = value;
+        writes.reset();
     }
 
     void setPixels(script::Value::Buffer& data) {
@@ -88,6 +92,13 @@ public:
     }
 
     void setPixel(S32 x, S32 y, U32 color) {
+        if (writes.expired()) {
+            auto scope = std::make_shared<Surface::WriteScope>(*surface);
+            writes = scope;
+            inject<script::Engine>{}->afterEval([scope, surface = surface](bool) mutable {
+                scope.reset();
+            });
+        }
         surface->setPixel(x, y, color);
     }
 
@@ -67,6 +67,7 @@ public:
         SDL_GL_SetAttribute(SDL_GL_CONTEXT_MINOR_VERSION, oglMinor);
         SDL_GL_SetAttribute(SDL_GL_CONTEXT_PROFILE_MASK, oglProfile == "es" ? SDL_GL_CONTEXT_PROFILE_ES : SDL_GL_CONTEXT_PROFILE_CORE);
         context = SDL_GL_CreateContext(window);
+        graphics->usePBO = config->properties->get<bool>("OpenGLPixelBuffers");
         String version = std::to_string(oglMajor) + std::to_string(oglMinor) + "0 " + oglProfile;
         logV("Creating OGL context: ", version, " ", context ? "Success" : "Failed");
         if (!context) {
@@ -115,7 +115,7 @@ public:
     }
 
     U64 write(const void* buffer, U64 size) override {
-        return file ? SDL_RWwrite(file, buffer, size, 1) : 0;
+        return file ? SDL_RWwrite(file, buffer, 1, size) : 0;
     }
 };
 
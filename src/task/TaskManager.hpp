@@ -5,6 +5,7 @@
 #pragma once
 
 #include <common/inject.hpp>
+#include <common/Rect.hpp>
 #include <common/Value.hpp>
 
 class TaskHandle;
@@ -71,5 +72,57 @@ public:
 
 class TaskManager : public Injectable<TaskManager> {
 public:
+    using Job = std::function<void(U32 index)>;
+    using RangeJob = std::function<void(U32 begin, U32 end)>;
+    using TileJob = std::function<void(const Rect& tile)>;
+
     virtual TaskHandle add(Task::Run&& run, Task::Complete&& complete) = 0;
+
+    // Calls job(0) to job(count - 1), in no particular order and possibly
+    // in parallel, then returns once all of them are done.
+    virtual void parallelFor(U32 count, const Job& job) {
+        for (U32 i = 0; i < count; ++i)
+            job(i);
+    }
+
+    // Splits [begin, end) into chunks of up to grain items and calls
+    // job(chunkBegin, chunkEnd) for each of them, like parallelFor above.
+    void parallelFor(U32 begin, U32 end, U32 grain, const RangeJob& job) {
+        if (end <= begin)
+            return;
+        grain = std::max<U32>(grain, 1);
+        U32 chunks = (end - begin + grain - 1) / grain;
+        parallelFor(chunks, [&](U32 chunk) {
+            U32 first = begin + chunk * grain;
+            job(first, std::min(first + grain, end));
+        });
+    }
+
+    // parallelFor(0, count, grain, job) on the injected TaskManager, or
+    // job(0, count) on this thread when there is none.
+    static void parallelRange(U32 count, U32 grain, const RangeJob& job) {
+        if (inject<TaskManager> taskman{InjectSilent::Yes})
+            taskman->parallelFor(0, count, grain, job);
+        else if (count)
+            job(0, count);
+    }
+
+    // Splits rect into tiles of up to tileSize x tileSize pixels, aligned
+    // to rect's top-left corner, and calls job once per tile.
+    void parallelTiles(const Rect& rect, U32 tileSize, const TileJob& job) {
+        if (rect.empty())
+            return;
+        tileSize = std::max<U32>(tileSize, 1);
+        U32 columns = (rect.width + tileSize - 1) / tileSize;
+        U32 rows = (rect.height + tileSize - 1) / tileSize;
+        parallelFor(columns * rows, [&](U32 index) {
+            Rect tile{
+                S32(rect.x + index % columns * tileSize),
+                S32(rect.y + index / columns * tileSize),
+                tileSize,
+                tileSize
+            };
+            job(tile.intersect(rect));
+        });
+    }
 };
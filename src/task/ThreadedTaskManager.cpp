@@ -4,8 +4,11 @@
 
 #if !defined(NO_THREADS)
 
+#include <algorithm>
 #include <atomic>
-#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <memory>
 #include <mutex>
 #include <thread>
 
@@ -26,7 +29,6 @@ public:
 
 class ThreadedTaskManager : public TaskManager {
 public:
-    static constexpr U32 maxRunners = 8;
     using Mutex = std::mutex;
     using Guard = std::lock_guard<Mutex>;
 
@@ -35,48 +37,105 @@ public:
     Vector<std::shared_ptr<NativeTask>> done;
     Mutex doneMut;
 
-    Vector<std::shared_ptr<NativeTask>> queue;
-    Mutex queueMut;
+    // Each worker pops the newest task from the back of its own deque and
+    // steals the oldest one from the front of the others when it runs dry.
+    class Worker {
+    public:
+        std::deque<std::shared_ptr<NativeTask>> queue;
+        Mutex mut;
+        std::thread thread;
+    };
+    std::vector<std::unique_ptr<Worker>> workers;
+
+    static inline thread_local ThreadedTaskManager* currentManager = nullptr;
+    static inline thread_local U32 currentWorker = 0;
+
+    std::atomic<S32> pending = 0;
+    std::atomic<U32> nextWorker = 0;
+    std::condition_variable wakeup;
+    Mutex sleepMut;
 
-    std::vector<std::thread> threads;
     std::atomic_bool isLive = false;
 
     void init() {
         isLive = true;
-        threads.resize(maxRunners);
-        for (auto& thread : threads)
-            thread = std::thread([=]{run();});
+        U32 count = std::max<U32>(1, std::thread::hardware_concurrency());
+        workers.resize(count);
+        for (auto& worker : workers)
+            worker = std::make_unique<Worker>();
+        for (U32 i = 0; i < count; ++i)
+            workers[i]->thread = std::thread([=]{run(i);});
     }
 
     ~ThreadedTaskManager() {
-        isLive = false;
-        for (auto& thread : threads)
-            thread.join();
-        threads.clear();
+        {
+            Guard sleepLock{sleepMut};
+            isLive = false;
+        }
+        wakeup.notify_all();
+        for (auto& worker : workers)
+            worker->thread.join();
+        workers.clear();
+    }
+
+    void push(std::shared_ptr<NativeTask>&& task) {
+        U32 index = currentManager == this ? currentWorker : nextWorker++ % workers.size();
+        {
+            Guard queueLock{workers[index]->mut};
+            workers[index]->queue.push_back(std::move(task));
+        }
+        {
+            Guard sleepLock{sleepMut};
+            pending++;
+        }
+        wakeup.notify_one();
     }
 
-    void run() {
+    std::shared_ptr<NativeTask> pop(U32 self) {
         std::shared_ptr<NativeTask> task;
-        while (isLive) {
-            if (!task) {
-                Guard queueLock{queueMut};
-                if (!queue.empty()) {
-                    task = queue.front();
-                    queue.erase(queue.begin());
-                }
+        {
+            auto& worker = *workers[self];
+            Guard queueLock{worker.mut};
+            if (!worker.queue.empty()) {
+                task = std::move(worker.queue.back());
+                worker.queue.pop_back();
             }
+        }
+        for (U32 i = 1, max = workers.size(); !task && i < max; ++i) {
+            auto& victim = *workers[(self + i) % max];
+            Guard queueLock{victim.mut};
+            if (!victim.queue.empty()) {
+                task = std::move(victim.queue.front());
+                victim.queue.pop_front();
+            }
+        }
+        if (task)
+            pending--;
+        return task;
+    }
+
+    void run(U32 self) {
+        currentManager = this;
+        currentWorker = self;
+        while (isLive) {
+            auto task = pop(self);
             if (!task) {
-                std::this_thread::sleep_for(std::chrono::milliseconds(50));
+                std::unique_lock<Mutex> sleepLock{sleepMut};
+                wakeup.wait(sleepLock, [&]{return pending > 0 || !isLive;});
                 continue;
             }
 
-            if (task->isCancelled()) {
-                task.reset();
+            if (task->isCancelled())
                 continue;
-            }
 
             task->result = task->run();
             if (task->result.empty()) {
+                // Not finished yet, run it again once newer work had a turn.
+                {
+                    Guard queueLock{workers[self]->mut};
+                    workers[self]->queue.push_front(std::move(task));
+                }
+                pending++;
                 continue;
             }
 
@@ -85,20 +144,16 @@ public:
                 done.push_back(task);
                 task->done = true;
             }
-            task.reset();
         }
     }
 
     void on(const msg::Tick&) {
-        while (true) {
-            std::shared_ptr<NativeTask> task;
-            {
-                Guard doneLock{doneMut};
-                if (done.empty())
-                    return;
-                task = done.front();
-                done.erase(done.begin());
-            }
+        Vector<std::shared_ptr<NativeTask>> finished;
+        {
+            Guard doneLock{doneMut};
+            finished.swap(done);
+        }
+        for (auto& task : finished) {
             if (!task->isCancelled()) {
                 task->complete(std::move(task->result));
             }
@@ -111,13 +166,52 @@ public:
         auto task = std::make_shared<NativeTask>();
         task->run = std::move(run);
         task->complete = std::move(complete);
+        TaskHandle handle{std::static_pointer_cast<Task>(task)};
+        push(std::move(task));
+        return handle;
+    }
 
-        {
-            Guard queueLock{queueMut};
-            queue.push_back(task);
+    using TaskManager::parallelFor;
+
+    void parallelFor(U32 count, const Job& job) override {
+        if (count < 2) {
+            TaskManager::parallelFor(count, job);
+            return;
+        }
+
+        if (!isLive)
+            init();
+
+        struct Batch {
+            std::atomic<U32> next = 0;
+            std::atomic<U32> finished = 0;
+            U32 count;
+            const Job* job;
+        };
+
+        auto batch = std::make_shared<Batch>();
+        batch->count = count;
+        batch->job = &job;
+
+        // Helpers that start after the batch is drained never touch `job`.
+        auto work = [batch] {
+            for (U32 i; (i = batch->next++) < batch->count; batch->finished++) {
+                (*batch->job)(i);
+            }
+        };
+
+        for (U32 i = 1, max = std::min<U32>(count, workers.size()); i < max; ++i) {
+            auto task = std::make_shared<NativeTask>();
+            task->run = [=]() -> Value {work(); return true;};
+            task->complete = [](Value&&){};
+            push(std::move(task));
         }
 
-        return std::static_pointer_cast<Task>(task);
+        // The calling thread works too, so the batch finishes even when
+        // every worker is busy or this is called from a worker.
+        work();
+        while (batch->finished != count)
+            std::this_thread::yield();
     }
 };
 
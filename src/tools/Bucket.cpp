@@ -2,11 +2,14 @@
 // This file is released under the terms of the MIT license.
 // Read LICENSE.txt for more information.
 
+#include <cstring>
+
 #include <cmd/Command.hpp>
 #include <common/line.hpp>
 #include <common/Surface.hpp>
 #include <doc/Document.hpp>
 #include <doc/Selection.hpp>
+#include <task/TaskManager.hpp>
 #include <tools/Tool.hpp>
 
 class Bucket : public  Tool {
@@ -78,47 +81,113 @@ public:
 
         S32 width = surface->width();
         S32 height = surface->height();
+        auto pixels = surface->data();
+
+        U8 target[4];
+        auto targetU32 = targetColor.toU32();
+        std::memcpy(target, &targetU32, sizeof(target));
+
+        // Selection amount for each pixel in a row, 0 where it doesn't match.
+        auto match = [&](U8* out, S32 y) {
+            auto in = reinterpret_cast<const U8*>(pixels + y * width);
+            for (S32 x = 0; x < width; ++x) {
+                S32 distance = threshold;
+                for (S32 c = 0; c < 4; ++c) {
+                    S32 d = S32{in[x * 4 + c]} - target[c];
+                    distance -= d * d;
+                }
+                U8 amount = 0;
+                if (distance > 0 || (distance == 0 && !threshold))
+                    amount = proportional ? std::max(1, distance * 255 / threshold) : 255;
+                out[x] = amount;
+            }
+        };
+
+        Vector<U8> amounts(width * height);
+        Rect filled;
 
         if (*contiguous ^ (which != 1)) {
-            Path queue = points;
-            while (!queue.empty()) {
-                S32 x = queue.back().x;
-                S32 y = queue.back().y;
-                queue.pop_back();
-                if (x < 0 || y < 0 || x >= width || y >= height || selection->get(x, y))
+            // Scanline fill: rows are matched the first time a span reaches
+            // them, filled pixels are recorded in mask.
+            Vector<U8> mask(width * height);
+            Vector<bool> matched(height);
+            auto row = [&](S32 y) {
+                if (!matched[y]) {
+                    matched[y] = true;
+                    match(&amounts[y * width], y);
+                }
+                return &amounts[y * width];
+            };
+
+            Vector<Point2D> seeds;
+            for (auto& point : points)
+                seeds.push_back({point.x, point.y});
+
+            while (!seeds.empty()) {
+                S32 x = seeds.back().x;
+                S32 y = seeds.back().y;
+                seeds.pop_back();
+                if (x < 0 || y < 0 || x >= width || y >= height)
                     continue;
 
-                auto srcPixel = surface->getPixelUnsafe(x, y);
-                S32 distance = threshold - targetColor.distanceSquared(srcPixel);
-                if (distance < 0 || (distance == 0 && threshold))
+                auto in = row(y);
+                auto out = &mask[y * width];
+                if (!in[x] || out[x])
                     continue;
 
-                U8 amount = proportional ? distance * 255 / threshold : 255;
-                if (!amount)
-                    amount = 1;
-                selection->add(x, y, amount);
-
-                if (x > 0) queue.push_back({x - 1, y});
-                if (y > 0) queue.push_back({x, y - 1});
-                if (y < height - 1) queue.push_back({x, y + 1});
-                if (x < width - 1) queue.push_back({x + 1, y});
-            }
-        } else {
-            for (U32 y = 0; y < height; ++y) {
-                for (U32 x = 0; x < width; ++x) {
-                    auto srcPixel = surface->getPixelUnsafe(x, y);
-                    S32 distance = threshold - targetColor.distanceSquared(srcPixel);
-                    if (distance < 0 || (distance == 0 && threshold))
+                S32 left = x, right = x + 1;
+                while (left > 0 && in[left - 1] && !out[left - 1])
+                    left--;
+                while (right < width && in[right] && !out[right])
+                    right++;
+                std::copy(in + left, in + right, out + left);
+                filled.expand(left, y);
+                filled.expand(right - 1, y);
+
+                for (S32 ny : {y - 1, y + 1}) {
+                    if (ny < 0 || ny >= height)
                         continue;
+                    auto nin = row(ny);
+                    auto nout = &mask[ny * width];
+                    bool inSpan = false;
+                    for (S32 nx = left; nx < right; ++nx) {
+                        bool open = nin[nx] && !nout[nx];
+                        if (open && !inSpan)
+                            seeds.push_back({nx, ny});
+                        inSpan = open;
+                    }
+                }
+            }
 
-                    U8 amount = proportional ? distance * 255 / threshold : 255;
-                    if (!amount)
-                        amount = 1;
-                    selection->add(x, y, amount);
+            amounts = std::move(mask);
+        } else {
+            // Each row records the range it matched in, so the selection
+            // only grows to what actually got filled.
+            Vector<S32> rowMin(height), rowMax(height);
+            auto fillRows = [&](U32 begin, U32 end) {
+                for (U32 y = begin; y < end; ++y) {
+                    auto out = &amounts[y * width];
+                    match(out, y);
+                    S32 min = 0, max = width;
+                    while (min < max && !out[min])
+                        min++;
+                    while (max > min && !out[max - 1])
+                        max--;
+                    rowMin[y] = min;
+                    rowMax[y] = max;
                 }
+            };
+            TaskManager::parallelRange(height, 16, fillRows);
+            for (S32 y = 0; y < height; ++y) {
+                if (rowMin[y] == rowMax[y])
+                    continue;
+                filled.expand(rowMin[y], y);
+                filled.expand(rowMax[y] - 1, y);
             }
         }
 
+        selection->add(filled, &amounts[filled.y * width + filled.x], width);
+
         paint->run();
     }
 };
@@ -4,6 +4,8 @@
 
 #pragma once
 
+#include <cmath>
+
 #include <blender/Blender.hpp>
 #include <cmd/Command.hpp>
 #include <common/FunctionRef.hpp>
@@ -48,6 +50,17 @@ public:
     Property<bool> pixelperfect{this, "pixelperfect", true, &Pencil::invalidateMetaMenu};
     Property<bool> HQ{this, "antialias", true};
 
+    // Coverage of one dab, relative to its center
+    struct Stamp {
+        S32 x, y;
+        U32 width, height;
+        Vector<U8> amounts;
+    };
+    // Stamps of the current shape by scale and antialiasing
+    HashMap<U32, Stamp> stamps;
+    static constexpr U32 stampResolution = 64;
+    Vector<U8> stampScratch;
+
     bool wasInit = false;
     S32 prevPlotX = 0, prevPlotY = 0, prevPlotZ = 0;
     U32 which;
@@ -68,11 +81,13 @@ public:
     void changeShape() {
         wasInit = true;
         shape = FileSystem::parse(shapeName);
+        stamps.clear();
         invalidateMetaMenu();
     }
 
     void on(msg::Flush& flush) {
         flush.hold(shape);
+        stamps.clear();
     }
 
     Vector<String> getBrushes() {
@@ -248,12 +263,6 @@ public:
             y += (rand() / F32(RAND_MAX) * 2.0f - 1.0f) * size * -smoothing;
         }
 
-        Color color;
-        S32 sw = S32(shape->width());
-        S32 sh = S32(shape->height());
-        S32 hsw = sw / 2;
-        S32 hsh = sh / 2;
-
         size += size * (rand() / F32(RAND_MAX) * *sizeVariation);
 
         if (pressuresize && which) {
@@ -266,60 +275,106 @@ public:
 
         if (size <= 1 || scale <= 0) {
             selection->add(x, y, 255 * alpha);
-        } else if (scale < 1) {
-            if (scale <= 0)
-                return;
+            return;
+        }
+
+        auto& stamp = getStamp(scale);
+        Rect rect{x + stamp.x, y + stamp.y, stamp.width, stamp.height};
+        if (alpha >= 1.0f) {
+            selection->add(rect, stamp.amounts.data(), stamp.width);
+        } else {
+            stampScratch.resize(stamp.amounts.size());
+            for (U32 i = 0, size = stamp.amounts.size(); i < size; ++i)
+                stampScratch[i] = stamp.amounts[i] * alpha;
+            selection->add(rect, stampScratch.data(), stamp.width);
+        }
+    }
+
+    // Returns the coverage of one dab of shape at scale, building it on first use
+    const Stamp& getStamp(F32 scale) {
+        U32 steps = std::max<U32>(1, scale * stampResolution + 0.5f);
+        U32 key = steps << 1 | (*HQ ? 1 : 0);
+        if (auto it = stamps.find(key); it != stamps.end())
+            return it->second;
+        scale = steps / F32(stampResolution);
+
+        S32 sw = S32(shape->width());
+        S32 sh = S32(shape->height());
+        S32 hsw = sw / 2;
+        S32 hsh = sh / 2;
+        auto pixels = shape->getPixels().data();
+        auto alphaAt = [&](S32 sx, S32 sy) -> U32 {
+            return (pixels[sx + sy * sw] >> Color::Ashift) & 0xFF;
+        };
+
+        struct Dot {
+            S32 x, y;
+            U32 amount;
+        };
+        Vector<Dot> dots;
+
+        if (scale < 1) {
             if (!*HQ) {
                 S32 step = 1 / scale;
                 for (S32 sy = step/2; sy < sh; sy += step) {
                     for (S32 sx = step/2; sx < sw; sx += step) {
-                        color = shape->getPixelUnsafe(sx, sy);
-                        selection->add(x + (sx - hsw) * scale, y + (sy - hsh) * scale, color.a * alpha);
+                        dots.push_back({
+                                S32(std::floor((sx - hsw) * scale)),
+                                S32(std::floor((sy - hsh) * scale)),
+                                alphaAt(sx, sy)
+                            });
                     }
                 }
             } else {
-                F32 density = alpha * scale * scale; // / ((1 / scale) * (1 / scale));
+                F32 density = scale * scale;
                 auto nh = S32(sh * scale + 0.5f);
                 auto nw = S32(sw * scale + 0.5f);
-                F32 tmp[nh + 1][nw + 1];
-
-                for (S32 sy = 0; sy < nh; ++sy) {
-                    for (S32 sx = 0; sx < nw; ++sx) {
-                        tmp[sy][sx] = 0;
-                    }
-                }
-
-                auto pixels = shape->getPixels().data();
+                Vector<F32> tmp((nh + 1) * (nw + 1));
                 for (S32 sy = 0; sy < sh; ++sy) {
                     for (S32 sx = 0; sx < sw; ++sx) {
-                        U32 v = (pixels[sx + sy * sw] >> Color::Ashift) & 0xFF;
-                        tmp[S32(sy * scale)][S32(sx * scale)] += v * density;
+                        tmp[S32(sy * scale) * (nw + 1) + S32(sx * scale)] += alphaAt(sx, sy) * density;
                     }
                 }
-
+                S32 ox = std::floor(-hsw * scale);
+                S32 oy = std::floor(-hsh * scale);
                 for (S32 sy = 0; sy < nh; ++sy) {
                     for (S32 sx = 0; sx < nw; ++sx) {
-                        auto color = tmp[sy][sx];
-                        selection->add(x + sx - (hsw * scale), y + sy - (hsh * scale), color);
+                        dots.push_back({ox + sx, oy + sy, U32(tmp[sy * (nw + 1) + sx])});
                     }
                 }
             }
         } else {
+            S32 block = scale;
             for (S32 sy = 0; sy < sh; ++sy) {
-                S32 oy = y + (sy - hsh) * scale;
-                S32 maxoy = oy + scale;
+                S32 oy = std::floor((sy - hsh) * scale);
                 for (S32 sx = 0; sx < sw; ++sx) {
-                    color = shape->getPixelUnsafe(sx, sy);
-                    S32 ox = x + (sx - hsw) * scale;
-                    S32 maxox = ox + scale;
-                    for (S32 ey = oy; ey < maxoy; ++ey) {
-                        for (S32 ex = ox; ex < maxox; ++ex) {
-                            selection->add(ex, ey, color.a * alpha);
+                    S32 ox = std::floor((sx - hsw) * scale);
+                    U32 amount = alphaAt(sx, sy);
+                    for (S32 ey = 0; ey < block; ++ey) {
+                        for (S32 ex = 0; ex < block; ++ex) {
+                            dots.push_back({ox + ex, oy + ey, amount});
                         }
                     }
                 }
             }
         }
+
+        Rect bounds;
+        for (auto& dot : dots) {
+            if (dot.amount)
+                bounds.expand(dot.x, dot.y);
+        }
+
+        Stamp stamp{bounds.x, bounds.y, bounds.width, bounds.height};
+        stamp.amounts.resize(bounds.width * bounds.height);
+        for (auto& dot : dots) {
+            if (!dot.amount)
+                continue;
+            auto& out = stamp.amounts[(dot.y - bounds.y) * bounds.width + (dot.x - bounds.x)];
+            out = std::min<U32>(0xFF, out + dot.amount);
+        }
+
+        return stamps.emplace(key, std::move(stamp)).first->second;
     }
 
     Path applySmoothing(Surface* surface, Path& points) {
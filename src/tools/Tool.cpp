@@ -61,34 +61,48 @@ void Tool::init(const String& name) {
     }
 }
 
+// Calls hline(x, y, length) and vline(x, y, length) in surface coordinates
+// for each cached outline edge that can be visible on surface
+template<typename HLine, typename VLine>
+static void strokeOutline(const Selection& selection, Surface& surface, const Rect& container, F32 scale, HLine&& hline, VLine&& vline) {
+    Rect visible {
+        S32(-container.x / scale),
+        S32(-container.y / scale),
+        U32(surface.width() / scale) + 2,
+        U32(surface.height() / scale) + 2
+    };
+    auto& outline = selection.getOutline();
+    for (auto& edge : outline.horizontal) {
+        if (edge.y < visible.y || edge.y > visible.bottom() ||
+            edge.x > visible.right() || edge.x + S32(edge.length) < visible.x)
+            continue;
+        S32 x0 = edge.x * scale + container.x;
+        S32 x1 = (edge.x + S32(edge.length)) * scale + container.x;
+        hline(x0, S32(edge.y * scale + container.y), x1 - x0 + 1);
+    }
+    for (auto& edge : outline.vertical) {
+        if (edge.x < visible.x || edge.x > visible.right() ||
+            edge.y > visible.bottom() || edge.y + S32(edge.length) < visible.y)
+            continue;
+        S32 y0 = edge.y * scale + container.y;
+        S32 y1 = (edge.y + S32(edge.length)) * scale + container.y;
+        vline(S32(edge.x * scale + container.x), y0, y1 - y0 + 1);
+    }
+}
+
 void Tool::Preview::drawOutlineSolid(bool clear, Preview& preview, Surface& surface, const Rect& container, F32 scale) {
     auto color = clear ? 0 : preview.overlayColor.toU32();
     Rect dirty;
-    bool before = false;
-    preview.overlay->apply(
-        {
-            S32(-container.x / scale),
-            S32(-container.y / scale),
-            surface.width(),
-            surface.height()
+    strokeOutline(*preview.overlay, surface, container, scale,
+        [&](S32 x, S32 y, S32 length) {
+            dirty.expand(x, y);
+            dirty.expand(x + length, y);
+            surface.setHLine(x, y, length, color);
         },
-        [&](S32 x, S32 y, U8 amount) {
-            bool above = preview.overlay->get(x, y - 1) > 127;
-            bool current = amount > 127;
-            if (above == current && before == current)
-                return;
-            S32 x0 = x * scale + container.x;
-            S32 y0 = y * scale + container.y;
-            dirty.expand(x0, y0);
-            if (above != current) {
-                dirty.expand(x0 + scale + 1, y0);
-                surface.setHLine(x0, y0, scale + 1, color);
-            }
-            if (before != current) {
-                before = current;
-                dirty.expand(x0, y0 + scale + 1);
-                surface.setVLine(x0, y0, scale + 1, color);
-            }
+        [&](S32 x, S32 y, S32 length) {
+            dirty.expand(x, y);
+            dirty.expand(x, y + length);
+            surface.setVLine(x, y, length, color);
         });
     dirty.intersect(surface.rect());
     surface.setDirty(dirty);
@@ -103,31 +117,16 @@ void Tool::Preview::drawOutlineAnts(bool clear, Preview& preview, Surface& surfa
     auto color = preview.overlayColor.toU32();
     auto invert = preview.altColor.toU32();
     Rect dirty;
-    bool before = false;
-    preview.overlay->apply(
-        {
-            S32(-container.x / scale),
-            S32(-container.y / scale),
-            surface.width(),
-            surface.height()
+    strokeOutline(*preview.overlay, surface, container, scale,
+        [&](S32 x, S32 y, S32 length) {
+            dirty.expand(x, y);
+            dirty.expand(x + length, y);
+            surface.antsHLine(x, y, length, antAge, color, invert);
         },
-        [&](S32 x, S32 y, U8 amount) {
-            bool above = preview.overlay->get(x, y - 1) > 127;
-            bool current = amount > 127;
-            if (above == current && before == current)
-                return;
-            S32 x0 = x * scale + container.x;
-            S32 y0 = y * scale + container.y;
-            dirty.expand(x0, y0);
-            if (above != current) {
-                dirty.expand(x0 + scale + 1, y0);
-                surface.antsHLine(x0, y0, scale + 1, antAge, color, invert);
-            }
-            if (before != current) {
-                before = current;
-                dirty.expand(x0, y0 + scale + 1);
-                surface.antsVLine(x0, y0, scale + 1, antAge, color, invert);
-            }
+        [&](S32 x, S32 y, S32 length) {
+            dirty.expand(x, y);
+            dirty.expand(x, y + length);
+            surface.antsVLine(x, y, length, antAge, color, invert);
         });
     dirty.intersect(surface.rect());
     surface.setDirty(dirty);
@@ -137,35 +136,31 @@ void Tool::Preview::drawFilledSolid(bool clear, Preview& preview, Surface& surfa
     auto color = clear ? 0 : preview.overlayColor.toU32();
     auto invertColor = clear ? 0 : preview.altColor.toU32();
     Rect dirty;
-    bool before = false;
     S32 scalei = scale + 0.5f;
-    preview.overlay->apply(
+    auto toSurfaceX = [&](S32 x) -> S32 {return x * scale + 0.5f + container.x;};
+    auto toSurfaceY = [&](S32 y) -> S32 {return y * scale + 0.5f + container.y;};
+    preview.overlay->traceOutline(
         {
             S32(-container.x / scale),
             S32(-container.y / scale),
             surface.width(),
             surface.height()
         },
-        [&](S32 x, S32 y, U8 amount) {
-            bool above = preview.overlay->get(x, y - 1) > 127;
-            bool current = amount > 127;
-            S32 x0 = x * scale + 0.5f + container.x;
-            S32 y0 = y * scale + 0.5f + container.y;
-            if (current) {
-                surface.fillRect({x0, y0, U32(scalei) + 1, U32(scalei) + 1}, color);
-            }
-            if (above == current && before == current)
-                return;
-            dirty.expand(x0, y0);
-            if (above != current) {
-                dirty.expand(x0 + scalei + 1, y0);
-                surface.setHLine(x0, y0, scalei + 1, invertColor);
-            }
-            if (before != current) {
-                before = current;
-                dirty.expand(x0, y0 + scalei + 1);
-                surface.setVLine(x0, y0, scalei + 1, invertColor);
-            }
+        [&](S32 x0, S32 x1, S32 y) {
+            S32 sx0 = toSurfaceX(x0), sx1 = toSurfaceX(x1), sy = toSurfaceY(y);
+            dirty.expand(sx0, sy);
+            dirty.expand(sx1 + 1, sy);
+            surface.setHLine(sx0, sy, sx1 - sx0 + 1, invertColor);
+        },
+        [&](S32 x, S32 y) {
+            S32 sx = toSurfaceX(x), sy = toSurfaceY(y);
+            dirty.expand(sx, sy);
+            dirty.expand(sx, sy + scalei + 1);
+            surface.setVLine(sx, sy, scalei + 1, invertColor);
+        },
+        [&](S32 x0, S32 x1, S32 y) {
+            S32 sx0 = toSurfaceX(x0), sx1 = toSurfaceX(x1), sy = toSurfaceY(y);
+            surface.fillRect({sx0, sy, U32(sx1 - sx0) + 1, U32(scalei) + 1}, color);
         });
     dirty.intersect(surface.rect());
     surface.setDirty(dirty);